@@ -0,0 +1,315 @@
+// Batch driver: replays a log of inserts, deletes and lookups through the tree
+// at full speed and reports the throughput at the end.
+//
+// Build: make avl_batch
+// Run:   ./avl_batch [-b] [-v] [-l snapshot] [-s snapshot] [-j json] [file]
+//
+// The log is read from file, or from stdin when it is left out or is "-".
+// The text format has one operation per line, blank lines and lines that
+// start with # are skipped:
+//   i <key>   insert key
+//   d <key>   delete key
+//   s <key>   search for key
+// With -b the log is binary instead: records of 5 bytes, the operation
+// letter followed by the key as a 32-bit int in host byte order.
+// With -v the AVL invariant of the final tree is checked.
+// With -l the tree starts out as the snapshot in the given file instead of
+// empty, and with -s the final tree is saved as a snapshot (see avl_image.h).
+// Built with -DAVL_INSTRUMENT the latency histograms of the operations are
+// printed at the end, and with -j also written to the given file as JSON.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "avl_image.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_batch.c needs the default int keys"
+#endif
+
+#define BATCH_BUFSIZE (1 << 16)
+
+// Input is pulled through one large buffer instead of a getc() per byte
+struct reader
+{
+    FILE *in;
+    unsigned char buf[BATCH_BUFSIZE];
+    size_t pos, len;
+};
+
+int reader_fill(struct reader *r)
+{
+    r->pos = 0;
+    r->len = fread(r->buf, 1, sizeof(r->buf), r->in);
+    return (r->len > 0);
+}
+
+// Returns the next byte, or EOF at the end of the input
+int reader_getc(struct reader *r)
+{
+    if (r->pos == r->len && !reader_fill(r))
+        return (EOF);
+    return (r->buf[r->pos++]);
+}
+
+// Reads n bytes into out, returns FALSE if the input ends first
+bool reader_read(struct reader *r, void *out, size_t n)
+{
+    unsigned char *p = (unsigned char *)out;
+    size_t k;
+
+    while (n > 0)
+    {
+        if (r->pos == r->len && !reader_fill(r))
+            return (FALSE);
+        k = r->len - r->pos;
+        if (k > n)
+            k = n;
+        memcpy(p, r->buf + r->pos, k);
+        r->pos += k;
+        p += k;
+        n -= k;
+    }
+    return (TRUE);
+}
+
+// Reads the next text operation. Returns 1 when *op and *key were set, 0 at
+// the end of the input and -1 on a malformed line, which is reported and
+// skipped. *line counts the lines read so far.
+int next_text_op(struct reader *r, int *op, int *key, long *line)
+{
+    int c, neg;
+    long v;
+
+    for (;;)
+    {
+        c = reader_getc(r);
+        while (c == ' ' || c == '\t' || c == '\r')
+            c = reader_getc(r);
+        if (c == EOF)
+            return (0);
+        ++*line;
+        if (c == '\n')
+            continue;
+        if (c == '#')
+        {
+            while (c != '\n' && c != EOF)
+                c = reader_getc(r);
+            continue;
+        }
+        *op = c;
+        c = reader_getc(r);
+        while (c == ' ' || c == '\t')
+            c = reader_getc(r);
+        neg = (c == '-');
+        if (neg)
+            c = reader_getc(r);
+        if (c < '0' || c > '9')
+            break;
+        v = 0;
+        while (c >= '0' && c <= '9')
+        {
+            v = v * 10 + (c - '0');
+            if (v > 2147483648L)
+                break;
+            c = reader_getc(r);
+        }
+        if (v > (neg ? 2147483648L : 2147483647L))
+            break;
+        while (c == ' ' || c == '\t' || c == '\r')
+            c = reader_getc(r);
+        if (c != '\n' && c != EOF)
+            break;
+        *key = (int)(neg ? -v : v);
+        return (1);
+    }
+    fprintf(stderr, "avl_batch: line %ld: expected <op> <key>\n", *line);
+    while (c != '\n' && c != EOF)
+        c = reader_getc(r);
+    return (-1);
+}
+
+// Reads the next binary record, same results as next_text_op()
+int next_binary_op(struct reader *r, int *op, int *key, long *record)
+{
+    int c = reader_getc(r);
+    int32_t k;
+
+    if (c == EOF)
+        return (0);
+    ++*record;
+    if (!reader_read(r, &k, sizeof(k)))
+    {
+        fprintf(stderr, "avl_batch: record %ld: truncated\n", *record);
+        return (0);
+    }
+    *op = c;
+    *key = k;
+    return (1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct avl_tree avl;
+    struct reader *r;
+    struct timespec t0, t1;
+    bool binary = FALSE, check = FALSE, inserted;
+    const char *path = NULL, *load_path = NULL, *save_path = NULL, *json_path = NULL;
+    struct avl_image img;
+    size_t inserts = 0, deletes = 0, searches = 0;
+    size_t added = 0, removed = 0, found = 0, errors = 0, ops;
+    long pos = 0;
+    int i, res, op, key;
+    double secs;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0)
+            binary = TRUE;
+        else if (strcmp(argv[i], "-v") == 0)
+            check = TRUE;
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            load_path = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            save_path = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (path == NULL)
+            path = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [-b] [-v] [-l snapshot] [-s snapshot] [-j json] [file]\n", argv[0]);
+            return (2);
+        }
+    }
+
+    r = (struct reader *)malloc(sizeof(struct reader));
+    if (r == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return (1);
+    }
+    r->pos = r->len = 0;
+    if (path == NULL || strcmp(path, "-") == 0)
+        r->in = stdin;
+    else if ((r->in = fopen(path, binary ? "rb" : "r")) == NULL)
+    {
+        perror(path);
+        free(r);
+        return (1);
+    }
+
+    avl_init(&avl);
+    if (load_path != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        res = image_open(&img, load_path);
+        if (res == 0)
+        {
+            res = image_to_tree(&avl, &img);
+            if (res != 0)
+                perror(load_path); // before image_close() can change errno
+            image_close(&img);
+        }
+        else
+            perror(load_path);
+        if (res != 0)
+        {
+            avl_destroy(&avl);
+            if (r->in != stdin)
+                fclose(r->in);
+            free(r);
+            return (1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("loaded:   %zu nodes in %.3f s\n", avl.count,
+               (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (;;)
+    {
+        res = binary ? next_binary_op(r, &op, &key, &pos) : next_text_op(r, &op, &key, &pos);
+        if (res == 0)
+            break;
+        if (res < 0)
+        {
+            errors++;
+            continue;
+        }
+        switch (op)
+        {
+        case 'i':
+            inserts++;
+            if (insert(&avl, key, &inserted) == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                return (1);
+            }
+            added += inserted;
+            break;
+        case 'd':
+            deletes++;
+            removed += delete(&avl, key);
+            break;
+        case 's':
+            searches++;
+            found += (avl_search(&avl, key) != NULL);
+            break;
+        default:
+            fprintf(stderr, "avl_batch: %s %ld: unknown operation '%c'\n",
+                    binary ? "record" : "line", pos, op);
+            errors++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (ferror(r->in))
+        perror(path != NULL ? path : "stdin");
+    if (r->in != stdin)
+        fclose(r->in);
+    free(r);
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    ops = inserts + deletes + searches;
+    printf("inserts:  %zu (%zu new)\n", inserts, added);
+    printf("deletes:  %zu (%zu found)\n", deletes, removed);
+    printf("searches: %zu (%zu found)\n", searches, found);
+    if (errors > 0)
+        printf("skipped:  %zu malformed operations\n", errors);
+    printf("nodes:    %zu\n", avl.count);
+    printf("elapsed:  %.3f s\n", secs);
+    printf("throughput: %.0f ops/s\n", secs > 0 ? ops / secs : 0.0);
+    avl_stats_dump(&avl, stdout);
+#ifdef AVL_INSTRUMENT
+    avl_instrument_dump(&avl, stdout, FALSE);
+    if (json_path != NULL)
+    {
+        FILE *json = fopen(json_path, "w");
+        if (json == NULL)
+        {
+            perror(json_path);
+            return (1);
+        }
+        avl_instrument_dump(&avl, json, TRUE);
+        fclose(json);
+    }
+#else
+    if (json_path != NULL)
+        fprintf(stderr, "avl_batch: built without AVL_INSTRUMENT, -j ignored\n");
+#endif
+    if (check)
+        printf("AVL invariant: %s\n", validate(&avl) ? "holds" : "VIOLATED");
+    if (save_path != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (avl_save(&avl, save_path) != 0)
+        {
+            perror(save_path);
+            return (1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("saved:    %s in %.3f s\n", save_path, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    }
+    avl_destroy(&avl);
+    return (errors > 0);
+}
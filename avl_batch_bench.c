@@ -0,0 +1,116 @@
+// Batched updates against one insert() or delete() per key.
+//
+// Build: make avl_batch_bench
+// Run:   ./avl_batch_bench [n] > results.csv
+//
+// The tree is loaded with n random keys (10^6 by default). Then for batch
+// sizes m = 10, 100, ... up to n, n new keys are inserted in batches of m,
+// first with a loop of insert() calls and then with insert_batch(), and
+// deleted again the same two ways. The new keys are either random (rand) or
+// increasing and larger than the loaded ones (seq), like time stamps. Each
+// workload and batch size gives one CSV line with the time per key of the
+// four runs and the speedup of the batches.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "avl_tree.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_batch_bench.c needs the default int keys"
+#endif
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Random keys below 2^30 from xorshift64*, so that the seq keys can start
+// above them. The multiplicative keys of
+// avl_bench.c are not used: consecutive ones land next to each other in the
+// tree, which would favour the loop.
+uint64_t rng_state = 88172645463325252ull;
+
+int rng_key(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (int)((rng_state * 2685821657736338717ull) >> 34);
+}
+
+void load(struct avl_tree *avl, size_t n)
+{
+    bool inserted;
+
+    avl_init(avl);
+    rng_state = 88172645463325252ull;
+    while (avl->count < n)
+        insert(avl, rng_key() & ~1, &inserted); // even keys, the new ones are odd
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = (argc > 1) ? (size_t)strtod(argv[1], NULL) : 1000000;
+    struct avl_tree avl;
+    const char *workloads[] = {"rand", "seq"};
+    double t0, loop_ins, loop_del, batch_ins, batch_del;
+    bool inserted;
+    size_t m, i, j, w;
+    int *keys;
+
+    keys = (int *)malloc(n * sizeof(int));
+    if (n == 0 || keys == NULL)
+    {
+        fprintf(stderr, "usage: %s [n]\n", argv[0]);
+        return (1);
+    }
+
+    printf("workload,n,batch,loop_insert_ns,batch_insert_ns,loop_delete_ns,batch_delete_ns,insert_speedup,delete_speedup\n");
+    for (w = 0; w < 2; w++)
+    {
+        for (m = 10; m <= n; m *= 10)
+        {
+            fprintf(stderr, "%s batches of %zu\n", workloads[w], m);
+            load(&avl, n);
+            for (i = 0; i < n; i++)
+                keys[i] = (w == 0) ? rng_key() | 1 : (1 << 30) + (int)i;
+            t0 = now_ns();
+            for (i = 0; i < n; i++)
+                insert(&avl, keys[i], &inserted);
+            loop_ins = (now_ns() - t0) / n;
+            t0 = now_ns();
+            for (i = 0; i < n; i++)
+                delete(&avl, keys[i]);
+            loop_del = (now_ns() - t0) / n;
+            avl_destroy(&avl);
+
+            load(&avl, n);
+            t0 = now_ns();
+            for (i = 0; i < n; i += m)
+            {
+                j = (n - i < m) ? n - i : m;
+                insert_batch(&avl, keys + i, NULL, j);
+            }
+            batch_ins = (now_ns() - t0) / n;
+            t0 = now_ns();
+            for (i = 0; i < n; i += m)
+            {
+                j = (n - i < m) ? n - i : m;
+                delete_batch(&avl, keys + i, j);
+            }
+            batch_del = (now_ns() - t0) / n;
+            if (avl.count != n)
+                fprintf(stderr, "%zu keys left instead of %zu\n", avl.count, n);
+            avl_destroy(&avl);
+
+            printf("%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f\n", workloads[w], n, m, loop_ins, batch_ins, loop_del, batch_del,
+                   loop_ins / batch_ins, loop_del / batch_del);
+            fflush(stdout);
+        }
+    }
+    free(keys);
+    return (0);
+}
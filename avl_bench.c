@@ -0,0 +1,370 @@
+// Benchmark of the AVL tree against the baselines: the compact AVL layout, the
+// unbalanced BST of ex_bst_9.c and the B-tree of btree.c.
+//
+// Build: make avl_bench avl_bench_order_stats
+// Run:   ./avl_bench [max_n] [workload] [structure] > results.csv
+//
+// avl_bench_order_stats is the same program built with -DAVL_ORDER_STATS; its
+// lines say order_stats in the config column, so appending its output
+// (without the header) to that of avl_bench shows what the sub-tree sizes
+// cost.
+//
+// Every workload is run for n = 10^3, 10^4, ... up to max_n (10^6 by
+// default, 10^8 is the largest size that is meant to be used):
+//   seq       keys inserted, searched and deleted in increasing order
+//   rand      distinct random keys, searched and deleted in random order
+//   zipf      random keys, searched with a Zipfian skew (theta 0.99)
+//   delheavy  random keys, then n operations of which 3 in 4 are deletes
+//             and 1 in 4 inserts of new keys; delete_ns is the cost per
+//             operation of that mix
+// One CSV line per workload, structure and size goes to stdout with the
+// time per operation of each phase, the memory the structure has allocated
+// for its nodes after loading (the node pool, the node array or the nodes
+// malloc'd one by one, without malloc's own overhead), the height after
+// loading and the number of rotations done. Progress goes to stderr.
+// The unbalanced BST degenerates into a list on sorted input, so it is left
+// out of the seq workload above BST_SEQ_LIMIT keys.
+
+#include "avl_tree.h"
+#define BST_NO_MAIN
+#include "ex_bst_9.c"
+#include "btree.c"
+
+#include <math.h>
+#include <time.h>
+
+#ifndef AVL_INT_KEYS
+#error "avl_bench.c needs the default int keys"
+#endif
+
+#define BST_SEQ_LIMIT (10000)
+#define ZIPF_THETA (0.99)
+
+#ifdef AVL_ORDER_STATS
+#define BENCH_CONFIG "order_stats"
+#else
+#define BENCH_CONFIG "default"
+#endif
+
+// The structures under test, each behind the same small interface
+struct avl_tree bench_avl;
+struct compact_tree bench_ct;
+struct bst_node *bench_bst;
+struct btree bench_bt;
+
+void avl_b_init(void) { avl_init(&bench_avl); }
+int avl_b_insert(int key)
+{
+    bool inserted;
+    insert(&bench_avl, key, &inserted);
+    return inserted;
+}
+int avl_b_search(int key) { return search(bench_avl.root, key) != NULL; }
+int avl_b_delete(int key) { return delete(&bench_avl, key); }
+void avl_b_destroy(void) { avl_destroy(&bench_avl); }
+size_t avl_b_rotations(void)
+{
+    const struct avl_stats *st = &bench_avl.stats;
+    return st->rot_ll + st->rot_lr + st->rot_rr + st->rot_rl + st->rot_r0 + st->rot_r1 + st->rot_rm1 +
+           st->rot_l0 + st->rot_l1 + st->rot_lm1;
+}
+size_t avl_b_bytes(void)
+{
+    const struct pool_chunk *chunk;
+    size_t bytes = 0;
+    for (chunk = bench_avl.pool.chunks; chunk != NULL; chunk = chunk->next)
+        bytes += sizeof(struct pool_chunk) + chunk->capacity * sizeof(struct node);
+    return bytes;
+}
+int avl_b_height(void)
+{
+    // follow the higher side, which the balance factor tells
+    const struct node *ptr = bench_avl.root;
+    int h = 0;
+    for (; ptr != NULL; h++)
+        ptr = (ptr->balance > 0) ? ptr->left : ptr->right;
+    return h;
+}
+
+void ct_b_init(void) { compact_init(&bench_ct); }
+int ct_b_insert(int key)
+{
+    bool inserted;
+    compact_insert(&bench_ct, key, &inserted);
+    return inserted;
+}
+int ct_b_search(int key) { return compact_search(&bench_ct, key) != NULL; }
+int ct_b_delete(int key) { return compact_delete(&bench_ct, key); }
+void ct_b_destroy(void) { compact_destroy(&bench_ct); }
+size_t ct_b_rotations(void) { return 0; } // the compact layout keeps no statistics
+size_t ct_b_bytes(void) { return bench_ct.capacity * sizeof(struct cnode); }
+int ct_b_height(void)
+{
+    uint32_t idx = bench_ct.root;
+    int h = 0;
+    for (; idx != CNODE_NIL; h++)
+        idx = (CNODE_BALANCE(&bench_ct.nodes[idx]) > 0) ? bench_ct.nodes[idx].left : CNODE_RIGHT(&bench_ct.nodes[idx]);
+    return h;
+}
+
+void bst_b_init(void) { bench_bst = create_tree(bench_bst); }
+int bst_b_insert(int key)
+{
+    if (searchElement(bench_bst, key) != NULL)
+        return 0;
+    bench_bst = insertElement(bench_bst, key);
+    return 1;
+}
+int bst_b_search(int key) { return searchElement(bench_bst, key) != NULL; }
+int bst_b_delete(int key)
+{
+    if (searchElement(bench_bst, key) == NULL)
+        return 0;
+    bench_bst = deleteElement(bench_bst, key);
+    return 1;
+}
+void bst_free(struct bst_node *ptr)
+{
+    if (ptr != NULL)
+    {
+        bst_free(ptr->left);
+        bst_free(ptr->right);
+        free(ptr);
+    }
+}
+void bst_b_destroy(void) { bst_free(bench_bst); bench_bst = NULL; }
+size_t bst_b_rotations(void) { return 0; }
+size_t bst_count(const struct bst_node *ptr)
+{
+    return ptr == NULL ? 0 : bst_count(ptr->left) + bst_count(ptr->right) + 1;
+}
+size_t bst_b_bytes(void) { return bst_count(bench_bst) * sizeof(struct bst_node); }
+int bst_height(const struct bst_node *ptr)
+{
+    int lh, rh;
+    if (ptr == NULL)
+        return 0;
+    lh = bst_height(ptr->left);
+    rh = bst_height(ptr->right);
+    return (lh >= rh ? lh : rh) + 1;
+}
+int bst_b_height(void) { return bst_height(bench_bst); }
+
+void bt_b_init(void) { btree_init(&bench_bt); }
+int bt_b_insert(int key) { return btree_insert(&bench_bt, key); }
+int bt_b_search(int key) { return btree_search(&bench_bt, key); }
+int bt_b_delete(int key) { return btree_delete(&bench_bt, key); }
+void bt_b_destroy(void) { btree_destroy(&bench_bt); }
+size_t bt_b_rotations(void) { return 0; }
+size_t bt_count(const struct btree_node *x)
+{
+    size_t nodes = 1;
+    int i;
+    if (!x->leaf)
+        for (i = 0; i <= x->n; i++)
+            nodes += bt_count(x->child[i]);
+    return nodes;
+}
+size_t bt_b_bytes(void) { return bench_bt.root == NULL ? 0 : bt_count(bench_bt.root) * sizeof(struct btree_node); }
+int bt_b_height(void) { return btree_height(&bench_bt); }
+
+struct structure
+{
+    const char *name;
+    void (*init)(void);
+    int (*insert)(int key);
+    int (*search)(int key);
+    int (*delete)(int key);
+    void (*destroy)(void);
+    size_t (*rotations)(void);
+    size_t (*bytes)(void);
+    int (*height)(void);
+};
+
+struct structure structures[] = {
+    {"avl", avl_b_init, avl_b_insert, avl_b_search, avl_b_delete, avl_b_destroy, avl_b_rotations, avl_b_bytes, avl_b_height},
+    {"avl_compact", ct_b_init, ct_b_insert, ct_b_search, ct_b_delete, ct_b_destroy, ct_b_rotations, ct_b_bytes, ct_b_height},
+    {"bst", bst_b_init, bst_b_insert, bst_b_search, bst_b_delete, bst_b_destroy, bst_b_rotations, bst_b_bytes, bst_b_height},
+    {"btree", bt_b_init, bt_b_insert, bt_b_search, bt_b_delete, bt_b_destroy, bt_b_rotations, bt_b_bytes, bt_b_height},
+};
+#define NSTRUCTURES (sizeof(structures) / sizeof(structures[0]))
+
+const char *workloads[] = {"seq", "rand", "zipf", "delheavy"};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+uint64_t rng_state = 88172645463325252ull;
+
+uint64_t rng_next(void) // xorshift64*
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+double rng_unit(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// i-th distinct pseudo-random key: multiplication by an odd constant is a
+// bijection on 32-bit integers
+int scramble(size_t i)
+{
+    return (int)(uint32_t)((uint32_t)i * 2654435761u);
+}
+
+void shuffle(int *a, size_t n)
+{
+    size_t i, j;
+    int t;
+    for (i = n; i > 1; i--)
+    {
+        j = rng_next() % i;
+        t = a[i - 1];
+        a[i - 1] = a[j];
+        a[j] = t;
+    }
+}
+
+// Zipfian ranks in [0, n) after Gray et al., as used by YCSB
+struct zipf
+{
+    size_t n;
+    double alpha, zetan, eta, theta;
+};
+
+void zipf_init(struct zipf *z, size_t n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+    size_t i;
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+size_t zipf_next(const struct zipf *z)
+{
+    double u = rng_unit(), uz = u * z->zetan;
+    size_t r;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    r = (size_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void run(const char *workload, const struct structure *s, size_t n)
+{
+    int *ins = (int *)malloc(n * sizeof(int));
+    int *ops = (int *)malloc(n * sizeof(int));
+    double t0, t_ins, t_srch, t_del;
+    size_t bytes;
+    size_t i, hits = 0, d = 0;
+    struct zipf z;
+    int height;
+
+    if (ins == NULL || ops == NULL)
+    {
+        fprintf(stderr, "Out of memory at n = %zu\n", n);
+        exit(1);
+    }
+    for (i = 0; i < n; i++)
+        ins[i] = (workload[0] == 's') ? (int)i : scramble(i);
+    if (workload[0] != 's')
+        shuffle(ins, n);
+
+    s->init();
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        s->insert(ins[i]);
+    t_ins = (now_ns() - t0) / n;
+    bytes = s->bytes();
+    height = s->height();
+
+    // search order: the insert order for seq, a Zipfian draw for zipf and
+    // a fresh random order otherwise
+    memcpy(ops, ins, n * sizeof(int));
+    if (strcmp(workload, "zipf") == 0)
+    {
+        zipf_init(&z, n, ZIPF_THETA);
+        for (i = 0; i < n; i++)
+            ops[i] = ins[zipf_next(&z)];
+    }
+    else if (workload[0] != 's')
+        shuffle(ops, n);
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        hits += s->search(ops[i]);
+    t_srch = (now_ns() - t0) / n;
+    if (hits != n)
+        fprintf(stderr, "%s/%s: %zu of %zu keys found\n", workload, s->name, hits, n);
+
+    memcpy(ops, ins, n * sizeof(int));
+    if (workload[0] != 's')
+        shuffle(ops, n);
+    t0 = now_ns();
+    if (strcmp(workload, "delheavy") == 0)
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (i % 4 == 3)
+                s->insert(scramble(n + i));
+            else
+                s->delete(ops[d++]);
+        }
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+            s->delete(ops[i]);
+    }
+    t_del = (now_ns() - t0) / n;
+
+    printf("%s,%s,%s,%zu,%.1f,%.1f,%.1f,%zu,%.1f,%d,%zu\n", workload, s->name, BENCH_CONFIG, n,
+           t_ins, t_srch, t_del, (bytes + 1023) / 1024, (double)bytes / n, height, s->rotations());
+    fflush(stdout);
+    s->destroy();
+    free(ins);
+    free(ops);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_n = (argc > 1) ? (size_t)strtod(argv[1], NULL) : 1000000;
+    const char *only_workload = (argc > 2) ? argv[2] : NULL;
+    const char *only_structure = (argc > 3) ? argv[3] : NULL;
+    size_t n, w, k;
+
+    printf("workload,structure,config,n,insert_ns,search_ns,delete_ns,mem_kb,bytes_per_key,height,rotations\n");
+    for (w = 0; w < NWORKLOADS; w++)
+    {
+        if (only_workload != NULL && strcmp(only_workload, workloads[w]) != 0)
+            continue;
+        for (n = 1000; n <= max_n; n *= 10)
+            for (k = 0; k < NSTRUCTURES; k++)
+            {
+                if (only_structure != NULL && strcmp(only_structure, structures[k].name) != 0)
+                    continue;
+                if (strcmp(structures[k].name, "bst") == 0 && workloads[w][0] == 's' && n > BST_SEQ_LIMIT)
+                    continue;
+                fprintf(stderr, "%s %s %zu\n", workloads[w], structures[k].name, n);
+                run(workloads[w], &structures[k], n);
+            }
+    }
+    return 0;
+}
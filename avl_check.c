@@ -0,0 +1,780 @@
+// Soak test of the library: random traffic checked against a plain bitmap of
+// the keys, with validate() and compact_validate() after every phase.
+//
+// Build: make check (builds and runs it in every configuration)
+// Run:   ./avl_check [rounds]
+//
+// make check builds the program three times, as avl_check with the library
+// as it is, as avl_check_order_stats with -DAVL_ORDER_STATS and as
+// avl_check_relaxed with -DAVL_RELAXED, and runs each. Every round (4 by
+// default) goes through these phases on one tree:
+//   updates   random insert(), delete() and search()
+//   batches   insert_batch() and delete_batch() of random keys
+//   split     avl_split() at a random key and avl_join() back together
+//   sets      avl_union(), avl_intersection() or avl_difference() with a
+//             second random tree, on several threads
+//   compact   a compact copy of the tree, changed with random updates
+//   image     avl_save() and the snapshot read back with image_search(),
+//             image_to_tree() and image_to_compact(), compared with the tree
+//             key by key, and copies of the file with one byte changed, cut
+//             short or made longer, which image_open() must turn down (this
+//             phase also runs once on the empty tree, before the first round)
+//   lookups   search_batch(), frozen_search_batch() and the lookup engine
+//             against search() key by key, for present and absent keys and
+//             batches that are not a multiple of the lookups in flight
+//   rebalance avl_rebalance(), after which the tree is strictly balanced
+// Frozen copies of small trees are checked before the first round as well.
+// After the rounds the persistent trees are checked by keeping old versions
+// while new ones are made. Last come two threaded cases: readers of an RCU
+// tree that check snapshots while a writer changes it, and threads that
+// change a sharded map at the same time. To run those under ThreadSanitizer:
+//   make clean && make check CFLAGS="-O1 -g -pthread -fsanitize=thread"
+// The first failed check is reported with its line and the program exits
+// with status 1.
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "avl_engine.h"
+#include "avl_frozen.h"
+#include "avl_image.h"
+#include "avl_set.h"
+#include "avl_rcu.h"
+#include "avl_shard.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_check.c needs the default int keys"
+#endif
+
+#if defined(AVL_RELAXED)
+#define CHECK_CONFIG "relaxed"
+#elif defined(AVL_ORDER_STATS)
+#define CHECK_CONFIG "order_stats"
+#else
+#define CHECK_CONFIG "default"
+#endif
+
+#define KEY_RANGE (1 << 16)
+#define CHECK_THREADS (4)
+#define LOOKUP_MAX (4099) // largest batch of lookups
+
+#define CHECK(cond) ((cond) ? (void)0 : check_failed(#cond, __LINE__))
+
+void check_failed(const char *what, int line)
+{
+    fprintf(stderr, "avl_check (%s): line %d: check failed: %s\n", CHECK_CONFIG, line, what);
+    exit(1);
+}
+
+uint64_t rng_state = 88172645463325252ull;
+
+uint64_t rng_next(uint64_t *state) // xorshift64*
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (*state * 2685821657736338717ull);
+}
+
+int rng_key(void)
+{
+    return ((int)(rng_next(&rng_state) % KEY_RANGE));
+}
+
+// The model: present[k] is 1 when k is in the tree
+char present[KEY_RANGE];
+size_t present_count;
+
+// Values are derived from the key, so that a value can be checked too
+int value_of(int key)
+{
+    return (key * 7 + 1);
+}
+
+// Checks a bare tree of count nodes, like the versions of a persistent tree
+void check_root(struct node *root, size_t count)
+{
+    struct avl_tree view;
+
+    view.root = root;
+    view.count = count;
+    CHECK(validate(&view));
+}
+
+// Largest balance factor in the tree, either way
+int max_imbalance(const struct node *ptr)
+{
+    int b, l, r;
+
+    if (ptr == NULL)
+        return (0);
+    b = abs(ptr->balance);
+    l = max_imbalance(ptr->left);
+    r = max_imbalance(ptr->right);
+    return (b > l ? (b > r ? b : r) : (l > r ? l : r));
+}
+
+// Checks the tree against the model: the invariant, the count, a sample of
+// lookups and, with AVL_ORDER_STATS, the ranks
+void check_tree(struct avl_tree *avl)
+{
+    struct node *ptr;
+    int i, key;
+
+    CHECK(validate(avl));
+    CHECK(avl->count == present_count);
+    for (i = 0; i < 1000; i++)
+    {
+        key = rng_key();
+        ptr = search(avl->root, key);
+        CHECK((ptr != NULL) == present[key]);
+        CHECK(ptr == NULL || ptr->value == value_of(key));
+    }
+#ifdef AVL_ORDER_STATS
+    {
+        size_t below = 0;
+
+        for (key = 0; key < KEY_RANGE; key++)
+        {
+            if (key % 997 == 0)
+                CHECK(avl_rank(avl, key) == below);
+            if (present[key])
+            {
+                if (below % 101 == 0)
+                    CHECK(avl_select(avl, below) != NULL && avl_select(avl, below)->data == key);
+                below++;
+            }
+        }
+    }
+#endif
+}
+
+void phase_updates(struct avl_tree *avl, int n)
+{
+    struct node *ptr;
+    bool inserted;
+    int i, key;
+
+    for (i = 0; i < n; i++)
+    {
+        key = rng_key();
+        switch (rng_next(&rng_state) % 3)
+        {
+        case 0:
+            ptr = insert(avl, key, &inserted);
+            CHECK(ptr != NULL && ptr->data == key);
+            CHECK(inserted == !present[key]);
+            if (inserted)
+            {
+                ptr->value = value_of(key);
+                present[key] = 1;
+                present_count++;
+            }
+            break;
+        case 1:
+            CHECK(delete(avl, key) == present[key]);
+            if (present[key])
+            {
+                present[key] = 0;
+                present_count--;
+            }
+            break;
+        default:
+            CHECK((search(avl->root, key) != NULL) == present[key]);
+        }
+    }
+}
+
+void phase_batches(struct avl_tree *avl, int n)
+{
+    int *keys = (int *)calloc(n, sizeof(int));
+    int *values = (int *)calloc(n, sizeof(int));
+    long added = 0, removed = 0;
+    int i;
+
+    CHECK(keys != NULL && values != NULL);
+    for (i = 0; i < n; i++)
+    {
+        keys[i] = rng_key();
+        values[i] = value_of(keys[i]);
+    }
+    for (i = 0; i < n; i++)
+        if (!present[keys[i]])
+        {
+            present[keys[i]] = 1;
+            added++;
+        }
+    CHECK(insert_batch(avl, keys, values, n) == added);
+    present_count += added;
+    check_tree(avl);
+
+    for (i = 0; i < n; i++)
+        keys[i] = rng_key();
+    for (i = 0; i < n; i++)
+        if (present[keys[i]])
+        {
+            present[keys[i]] = 0;
+            removed++;
+        }
+    CHECK(delete_batch(avl, keys, n) == removed);
+    present_count -= removed;
+    free(keys);
+    free(values);
+}
+
+void phase_split(struct avl_tree *avl)
+{
+    struct node *left, *right, *mid;
+    size_t below = 0;
+    int key = rng_key(), k, lh, rh, h;
+
+    for (k = 0; k < key; k++)
+        below += present[k];
+    mid = avl_split(avl->root, key, &left, &right);
+    CHECK((mid != NULL) == present[key]);
+    check_root(left, below);
+    check_root(right, present_count - below - present[key]);
+    if (mid != NULL)
+        avl->root = avl_join(left, mid, right);
+    else
+    {
+        lh = tree_height(left);
+        rh = tree_height(right);
+        avl->root = tree_join2(left, lh, right, rh, &h, &avl->stats);
+    }
+}
+
+void phase_sets(struct avl_tree *avl, int round)
+{
+    static char other[KEY_RANGE];
+    struct avl_tree b;
+    struct node *ptr;
+    bool inserted;
+    int key, op = round % 3;
+    size_t i;
+
+    avl_init(&b);
+    memset(other, 0, sizeof(other));
+    // A sparse tree to add or take away, a dense one to intersect with
+    for (i = 0; i < (op == 1 ? KEY_RANGE * 3 / 4 : KEY_RANGE / 8); i++)
+    {
+        key = rng_key();
+        ptr = insert(&b, key, &inserted);
+        CHECK(ptr != NULL);
+        ptr->value = value_of(key);
+        other[key] = 1;
+    }
+    if (op == 0)
+        avl_union(avl, &b);
+    else if (op == 1)
+        avl_intersection(avl, &b);
+    else
+        avl_difference(avl, &b);
+    present_count = 0;
+    for (key = 0; key < KEY_RANGE; key++)
+    {
+        if (op == 0)
+            present[key] |= other[key];
+        else if (op == 1)
+            present[key] &= other[key];
+        else
+            present[key] &= !other[key];
+        present_count += present[key];
+    }
+    if (op == 0)
+        CHECK(b.root == NULL && b.count == 0);
+    else
+        CHECK(validate(&b));
+    avl_destroy(&b);
+}
+
+void phase_compact(struct avl_tree *avl, int n)
+{
+    static char shadow[KEY_RANGE];
+    struct compact_tree ct;
+    struct cnode *cptr;
+    bool inserted;
+    int i, key;
+
+    compact_init(&ct);
+    CHECK(compact_from_tree(&ct, avl));
+    CHECK(compact_validate(&ct));
+    CHECK(ct.count == avl->count);
+    memcpy(shadow, present, sizeof(shadow));
+    for (i = 0; i < n; i++)
+    {
+        key = rng_key();
+        if (rng_next(&rng_state) % 2)
+        {
+            cptr = compact_insert(&ct, key, &inserted);
+            CHECK(cptr != NULL && inserted == !shadow[key]);
+            shadow[key] = 1;
+        }
+        else
+        {
+            CHECK(compact_delete(&ct, key) == shadow[key]);
+            shadow[key] = 0;
+        }
+    }
+    CHECK(compact_validate(&ct));
+    for (key = 0; key < KEY_RANGE; key++)
+        CHECK((compact_search(&ct, key) != NULL) == shadow[key]);
+    compact_destroy(&ct);
+}
+
+struct engine_result
+{
+    avl_key_t key;
+    struct node *ptr;
+    int calls;
+};
+
+void engine_done(void *ctx, avl_key_t key, struct node *ptr)
+{
+    struct engine_result *r = (struct engine_result *)ctx;
+
+    CHECK(key == r->key);
+    r->ptr = ptr;
+    r->calls++;
+}
+
+// Looks up keys[0] .. keys[n - 1] with search_batch(), a frozen copy and the
+// lookup engine, and checks each result against one search() per key
+void check_lookups(struct avl_tree *avl, const struct frozen_tree *ft, const avl_key_t *keys, size_t n, int width)
+{
+    static struct node *out[LOOKUP_MAX];
+    static const avl_value_t *values[LOOKUP_MAX];
+    static struct engine_result results[LOOKUP_MAX];
+    struct lookup_engine engine;
+    struct node *ptr;
+    size_t i, hits = 0, done = 0;
+
+    for (i = 0; i < n; i++)
+        hits += (search(avl->root, keys[i]) != NULL);
+    CHECK(search_batch(avl->root, keys, n, out) == hits);
+    CHECK(frozen_search_batch(ft, keys, n, values) == hits);
+    // A short queue, so that submitting has to wait for engine_step() too
+    CHECK(engine_init(&engine, avl->root, width, 5) == 0);
+    for (i = 0; i < n; i++)
+    {
+        results[i].key = keys[i];
+        results[i].ptr = NULL;
+        results[i].calls = 0;
+        while (!engine_submit(&engine, keys[i], engine_done, &results[i]))
+            done += engine_step(&engine);
+    }
+    done += engine_run(&engine);
+    engine_destroy(&engine);
+    CHECK(done == n);
+    for (i = 0; i < n; i++)
+    {
+        ptr = search(avl->root, keys[i]);
+        CHECK(out[i] == ptr);
+        CHECK(results[i].calls == 1 && results[i].ptr == ptr);
+        CHECK(values[i] == frozen_search(ft, keys[i]));
+        CHECK(values[i] == NULL ? ptr == NULL : ptr != NULL && *values[i] == ptr->value);
+    }
+}
+
+// Batches of sizes around the number of lookups in flight, present and absent
+// keys mixed, some of them below or above every key of the tree
+void phase_lookups(struct avl_tree *avl)
+{
+    static const size_t sizes[] = {1, 2, SEARCH_BATCH - 1, SEARCH_BATCH + 1, 3 * FROZEN_BATCH + 5, 1000,
+                                   LOOKUP_MAX};
+    static avl_key_t keys[LOOKUP_MAX];
+    struct frozen_tree ft;
+    size_t i, s;
+
+    for (i = 0; i < LOOKUP_MAX; i++)
+        keys[i] = (i % 61 == 0) ? (int)i - KEY_RANGE : (i % 67 == 0) ? KEY_RANGE + (int)i : rng_key();
+    frozen_init(&ft);
+    CHECK(avl_freeze(&ft, avl));
+    CHECK(ft.count == avl->count);
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        check_lookups(avl, &ft, keys, sizes[s], (s % 2) ? 7 : 0);
+    frozen_destroy(&ft);
+}
+
+// Frozen copies of the trees of 0 .. 3 * FROZEN_B + 2 keys, whose last
+// nodes are padded in every possible way, looked up with every key and
+// every key in between
+void check_frozen_small(void)
+{
+    static avl_key_t keys[8 * FROZEN_B];
+    struct frozen_tree ft;
+    struct avl_tree avl;
+    struct node *ptr;
+    bool inserted;
+    int n, i;
+
+    frozen_init(&ft);
+    for (n = 0; n <= 3 * FROZEN_B + 2; n++)
+    {
+        avl_init(&avl);
+        for (i = 0; i < n; i++)
+        {
+            ptr = insert(&avl, 2 * i, &inserted);
+            CHECK(ptr != NULL);
+            ptr->value = value_of(2 * i);
+        }
+        for (i = 0; i < 2 * n + 3; i++)
+            keys[i] = i - 1;
+        CHECK(avl_freeze(&ft, &avl));
+        check_lookups(&avl, &ft, keys, 2 * n + 3, 3);
+        avl_destroy(&avl);
+    }
+    frozen_destroy(&ft);
+}
+
+// TRUE when this process still has path open or mapped, as far as /proc/self
+// shows; without /proc nothing is found
+bool still_open(const char *path)
+{
+    char line[4096], fd_path[300];
+    struct dirent *entry;
+    bool found = FALSE;
+    ssize_t len;
+    FILE *maps;
+    DIR *dir;
+
+    maps = fopen("/proc/self/maps", "r");
+    if (maps != NULL)
+    {
+        while (!found && fgets(line, sizeof(line), maps) != NULL)
+            found = (strstr(line, path) != NULL);
+        fclose(maps);
+    }
+    dir = opendir("/proc/self/fd");
+    if (dir != NULL)
+    {
+        while (!found && (entry = readdir(dir)) != NULL)
+        {
+            snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%s", entry->d_name);
+            len = readlink(fd_path, line, sizeof(line) - 1);
+            if (len > 0)
+            {
+                line[len] = '\0';
+                found = (strcmp(line, path) == 0);
+            }
+        }
+        closedir(dir);
+    }
+    return (found);
+}
+
+void write_file(const char *path, const unsigned char *data, size_t n)
+{
+    FILE *out = fopen(path, "wb");
+
+    CHECK(out != NULL);
+    CHECK(n == 0 || fwrite(data, n, 1, out) == 1);
+    CHECK(fclose(out) == 0);
+}
+
+// Writes data to path and checks that image_open() turns it down and leaves
+// nothing behind
+void check_rejected(const char *path, const unsigned char *data, size_t n)
+{
+    struct avl_image img;
+
+    write_file(path, data, n);
+    errno = 0;
+    CHECK(image_open(&img, path) == -1);
+    CHECK(errno == EINVAL || errno == EBADMSG);
+    CHECK(img.map == NULL && img.nodes == NULL && img.count == 0);
+    CHECK(!still_open(path));
+}
+
+// Saves the tree, reads it back in all three ways and compares them with the
+// tree key by key. Then one byte at a time of the file is changed, and the
+// file is cut short or made longer, and every such copy must be turned down.
+void phase_image(struct avl_tree *avl)
+{
+    char path[64], bad[64];
+    struct avl_image img;
+    struct avl_tree copy;
+    struct compact_tree ct;
+    const struct cnode *cptr;
+    struct node *ptr, *copied;
+    unsigned char *data, flip;
+    size_t length, i, pos;
+    FILE *in;
+    int key;
+
+    snprintf(path, sizeof(path), "/tmp/avl_check.%d.img", (int)getpid());
+    snprintf(bad, sizeof(bad), "/tmp/avl_check.%d.bad", (int)getpid());
+    CHECK(avl_save(avl, path) == 0);
+    CHECK(image_open(&img, path) == 0);
+    CHECK(img.count == avl->count);
+    avl_init(&copy);
+    compact_init(&ct);
+    CHECK(image_to_tree(&copy, &img) == 0);
+    CHECK(validate(&copy) && copy.count == avl->count);
+    CHECK(image_to_compact(&ct, &img) == 0);
+    CHECK(compact_validate(&ct) && ct.count == avl->count);
+    for (key = -1; key <= KEY_RANGE; key++)
+    {
+        ptr = search(avl->root, key);
+        cptr = image_search(&img, key);
+        CHECK(cptr == NULL ? ptr == NULL : ptr != NULL && cptr->value == ptr->value);
+        copied = search(copy.root, key);
+        CHECK(copied == NULL ? ptr == NULL : ptr != NULL && copied->value == ptr->value);
+        cptr = compact_search(&ct, key);
+        CHECK(cptr == NULL ? ptr == NULL : ptr != NULL && cptr->value == ptr->value);
+    }
+    compact_destroy(&ct);
+    avl_destroy(&copy);
+    image_close(&img);
+    CHECK(!still_open(path));
+
+    in = fopen(path, "rb");
+    CHECK(in != NULL && fseek(in, 0, SEEK_END) == 0);
+    length = (size_t)ftell(in);
+    rewind(in);
+    data = (unsigned char *)calloc(length + 1, 1);
+    CHECK(data != NULL && fread(data, length, 1, in) == 1);
+    fclose(in);
+    // Every byte of the header, and a sample of the nodes
+    for (i = 0; i < sizeof(struct image_header) + 32; i++)
+    {
+        pos = (i < sizeof(struct image_header))
+                  ? i
+                  : sizeof(struct image_header) + rng_next(&rng_state) % (length - sizeof(struct image_header));
+        flip = (unsigned char)(1 + rng_next(&rng_state) % 255);
+        data[pos] ^= flip;
+        check_rejected(bad, data, length);
+        data[pos] ^= flip;
+    }
+    check_rejected(bad, data, length - 1);
+    check_rejected(bad, data, length - sizeof(struct cnode));
+    check_rejected(bad, data, sizeof(struct image_header));
+    check_rejected(bad, data, sizeof(struct image_header) - 1);
+    check_rejected(bad, data, 0);
+    check_rejected(bad, data, length + 1);
+    // The same bytes put back open again
+    write_file(bad, data, length);
+    CHECK(image_open(&img, bad) == 0 && img.count == avl->count);
+    image_close(&img);
+    free(data);
+    remove(bad);
+    remove(path);
+}
+
+// Keeps a version every so many updates and checks all of them at the end,
+// when later versions have long replaced the nodes they started out with
+void check_persistent(int n)
+{
+    struct avl_arena arena;
+    struct node *root = NULL, *versions[64];
+    size_t counts[64], count = 0;
+    int kept = 0, i, key;
+    bool done;
+
+    arena_init(&arena);
+    for (i = 0; i < n; i++)
+    {
+        key = rng_key() % 4096;
+        if (rng_next(&rng_state) % 3)
+        {
+            root = persistent_insert(&arena, root, key, value_of(key), &done);
+            CHECK(root != NULL);
+            count += done;
+        }
+        else
+        {
+            root = persistent_delete(&arena, root, key, &done);
+            count -= done;
+        }
+        if (i % (n / 64) == 0 && kept < 64)
+        {
+            versions[kept] = root;
+            counts[kept++] = count;
+        }
+    }
+    for (i = 0; i < kept; i++)
+        check_root(versions[i], counts[i]);
+    check_root(root, count);
+    arena_destroy(&arena);
+}
+
+// RCU: the writer only changes odd keys and the even ones stay in the tree,
+// so a reader must always find those, and every snapshot must be valid
+struct rcu_tree check_rcu;
+atomic_int rcu_running;
+
+void *rcu_reader_main(void *arg)
+{
+    struct rcu_reader *reader = rcu_register(&check_rcu);
+    struct rcu_snapshot snap;
+    uint64_t state = (uint64_t)(uintptr_t)arg * 0x9E3779B97F4A7C15ull + 1;
+    avl_value_t value;
+    int key, passes = 0;
+
+    CHECK(reader != NULL);
+    while (atomic_load(&rcu_running) || passes < 10)
+    {
+        key = (int)(rng_next(&state) % (KEY_RANGE / 2)) * 2;
+        CHECK(rcu_search(&check_rcu, reader, key, &value) && value == value_of(key));
+        if (passes++ % 64 == 0 && rcu_snapshot_take(&check_rcu, &snap))
+        {
+            check_root(snap.root, snap.count);
+            rcu_snapshot_drop(&snap);
+        }
+    }
+    rcu_unregister(reader);
+    return (NULL);
+}
+
+void check_rcu_tree(int n)
+{
+    pthread_t threads[CHECK_THREADS];
+    int key, i;
+
+    rcu_init(&check_rcu);
+    for (key = 0; key < KEY_RANGE; key += 2)
+        CHECK(rcu_insert(&check_rcu, key, value_of(key)) == 1);
+    atomic_store(&rcu_running, 1);
+    for (i = 0; i < CHECK_THREADS; i++)
+        pthread_create(&threads[i], NULL, rcu_reader_main, (void *)(uintptr_t)(i + 1));
+    for (i = 0; i < n; i++)
+    {
+        key = rng_key() | 1;
+        if (rng_next(&rng_state) % 2)
+            CHECK(rcu_insert(&check_rcu, key, value_of(key)) >= 0);
+        else
+            rcu_delete(&check_rcu, key);
+    }
+    atomic_store(&rcu_running, 0);
+    for (i = 0; i < CHECK_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    check_root(rcu_root(&check_rcu), atomic_load(&check_rcu.count));
+    rcu_destroy(&check_rcu);
+}
+
+// Shards: every thread changes only the keys k with k % CHECK_THREADS equal
+// to its number, which lie in all shards, and keeps its own model of them
+struct shard_map check_map;
+char shard_present[KEY_RANGE];
+
+struct shard_worker
+{
+    pthread_t thread;
+    int id, n;
+};
+
+void *shard_worker_main(void *arg)
+{
+    struct shard_worker *w = (struct shard_worker *)arg;
+    uint64_t state = (uint64_t)(w->id + 1) * 0x9E3779B97F4A7C15ull;
+    avl_value_t value;
+    int i, key;
+
+    for (i = 0; i < w->n; i++)
+    {
+        key = (int)(rng_next(&state) % (KEY_RANGE / CHECK_THREADS)) * CHECK_THREADS + w->id;
+        switch (rng_next(&state) % 3)
+        {
+        case 0:
+            CHECK(shard_insert(&check_map, key, value_of(key)) == !shard_present[key]);
+            shard_present[key] = 1;
+            break;
+        case 1:
+            CHECK(shard_delete(&check_map, key) == shard_present[key]);
+            shard_present[key] = 0;
+            break;
+        default:
+            CHECK(shard_search(&check_map, key, &value) == shard_present[key]);
+            CHECK(!shard_present[key] || value == value_of(key));
+        }
+    }
+    return (NULL);
+}
+
+struct scan_state
+{
+    int prev;
+    size_t seen;
+};
+
+bool scan_visit(void *ctx, const struct node *ptr)
+{
+    struct scan_state *st = (struct scan_state *)ctx;
+
+    CHECK(ptr->data > st->prev && shard_present[ptr->data]);
+    st->prev = ptr->data;
+    st->seen++;
+    return (TRUE);
+}
+
+void check_shards(int n)
+{
+    struct shard_worker workers[CHECK_THREADS];
+    struct scan_state st = {-1, 0};
+    size_t count = 0;
+    int i, key;
+
+    CHECK(shard_init(&check_map, 16) == 0);
+    for (i = 0; i < CHECK_THREADS; i++)
+    {
+        workers[i].id = i;
+        workers[i].n = n;
+        pthread_create(&workers[i].thread, NULL, shard_worker_main, &workers[i]);
+    }
+    for (i = 0; i < CHECK_THREADS; i++)
+        pthread_join(workers[i].thread, NULL);
+    for (key = 0; key < KEY_RANGE; key++)
+        count += shard_present[key];
+    CHECK(shard_count(&check_map) == count);
+    for (i = 0; i < check_map.nshards; i++)
+        CHECK(validate(&check_map.shards[i].tree));
+    CHECK(shard_range_scan(&check_map, 0, KEY_RANGE, scan_visit, &st) == count && st.seen == count);
+    shard_destroy(&check_map);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 4;
+    struct avl_tree avl;
+    int round;
+
+    if (rounds < 1)
+    {
+        fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+        return (2);
+    }
+    avl_set_threads(CHECK_THREADS);
+    avl_init(&avl);
+    phase_image(&avl);
+    check_frozen_small();
+    for (round = 0; round < rounds; round++)
+    {
+        fprintf(stderr, "%s: round %d\n", CHECK_CONFIG, round + 1);
+        phase_updates(&avl, 100000);
+        check_tree(&avl);
+        phase_batches(&avl, 10000);
+        check_tree(&avl);
+        phase_split(&avl);
+        check_tree(&avl);
+        phase_sets(&avl, round);
+        check_tree(&avl);
+        phase_compact(&avl, 20000);
+        phase_image(&avl);
+        phase_lookups(&avl);
+        avl_rebalance(&avl);
+        check_tree(&avl);
+        CHECK(max_imbalance(avl.root) <= 1);
+    }
+    avl_destroy(&avl);
+    fprintf(stderr, "%s: persistent versions\n", CHECK_CONFIG);
+    check_persistent(20000);
+    fprintf(stderr, "%s: RCU readers and writer\n", CHECK_CONFIG);
+    check_rcu_tree(20000);
+    fprintf(stderr, "%s: sharded map\n", CHECK_CONFIG);
+    check_shards(20000);
+    printf("avl_check (%s): all checks passed\n", CHECK_CONFIG);
+    return (0);
+}
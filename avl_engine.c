@@ -0,0 +1,90 @@
+// Pipelined lookup engine, see avl_engine.h.
+
+#include "avl_engine.h"
+
+int engine_init(struct lookup_engine *e, struct node *root, int width, size_t capacity)
+{
+    e->root = root;
+    e->width = (width > 0) ? width : ENGINE_WIDTH;
+    e->active = 0;
+    e->capacity = (capacity > 0) ? capacity : 1;
+    e->head = e->count = 0;
+    e->slots = (struct lookup_slot *)malloc((size_t)e->width * sizeof(struct lookup_slot));
+    e->queue = (struct lookup_req *)malloc(e->capacity * sizeof(struct lookup_req));
+    if (e->slots == NULL || e->queue == NULL)
+    {
+        engine_destroy(e);
+        return (-1);
+    }
+    return (0);
+}
+
+void engine_destroy(struct lookup_engine *e)
+{
+    free(e->slots);
+    free(e->queue);
+    e->slots = NULL;
+    e->queue = NULL;
+    e->active = 0;
+    e->head = e->count = 0;
+}
+
+bool engine_submit(struct lookup_engine *e, avl_key_t key,
+                   void (*done)(void *ctx, avl_key_t key, struct node *ptr), void *ctx)
+{
+    struct lookup_req *req;
+
+    if (e->count == e->capacity)
+        return (FALSE);
+    req = &e->queue[(e->head + e->count++) % e->capacity];
+    req->key = key;
+    req->done = done;
+    req->ctx = ctx;
+    return (TRUE);
+}
+
+size_t engine_step(struct lookup_engine *e)
+{
+    struct lookup_slot *slot;
+    struct node *ptr;
+    size_t finished = 0;
+    int j, cmp;
+
+    // New lookups start at the root, which every lookup visits and so is
+    // never far away
+    while (e->active < e->width && e->count > 0)
+    {
+        slot = &e->slots[e->active++];
+        slot->req = e->queue[e->head];
+        slot->ptr = e->root;
+        e->head = (e->head + 1) % e->capacity;
+        e->count--;
+    }
+    for (j = 0; j < e->active;)
+    {
+        slot = &e->slots[j];
+        ptr = slot->ptr;
+        if (ptr != NULL && (cmp = KEY_CMP(slot->req.key, ptr->data)) != 0)
+        {
+            // Yield at the child, once it is on its way into the cache
+            slot->ptr = (cmp < 0) ? ptr->left : ptr->right;
+            if (slot->ptr != NULL)
+                __builtin_prefetch(slot->ptr);
+            j++;
+            continue;
+        }
+        slot->req.done(slot->req.ctx, slot->req.key, ptr);
+        finished++;
+        *slot = e->slots[--e->active]; // the last lookup moves here and is resumed next
+    }
+    return (finished);
+}
+
+size_t engine_run(struct lookup_engine *e)
+{
+    size_t finished = 0;
+
+    while (e->active > 0 || e->count > 0)
+        finished += engine_step(e);
+    return (finished);
+}
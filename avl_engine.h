@@ -0,0 +1,64 @@
+// Pipelined lookup engine for callers that have many lookups outstanding at
+// once, like a server front end, instead of a batch at hand.
+//
+// Every lookup is a small state machine that stands in for a coroutine: its
+// state is the node it goes to next. Each time it is resumed it compares its
+// key there and either finishes or moves to the child, prefetches it and
+// yields. engine_step() resumes every lookup in flight once, so while one
+// lookup waits for its node to arrive from memory the others go on, and up
+// to width cache misses are outstanding at a time. Lookups are submitted at
+// any time, also from the completion callbacks, and wait in a queue until a
+// slot is free.
+//
+// The engine only reads the tree. The tree must not change while lookups on
+// it are in flight.
+
+#ifndef AVL_ENGINE_H
+#define AVL_ENGINE_H
+
+#include "avl_tree.h"
+
+#define ENGINE_WIDTH (64) // default number of lookups in flight
+
+struct lookup_req
+{
+    avl_key_t key;
+    // Called with the node holding key, or NULL, when the lookup is done
+    void (*done)(void *ctx, avl_key_t key, struct node *ptr);
+    void *ctx;
+};
+
+struct lookup_slot
+{
+    struct node *ptr; // next node to compare at, already prefetched
+    struct lookup_req req;
+};
+
+struct lookup_engine
+{
+    struct node *root;
+    struct lookup_slot *slots; // the lookups in flight come first
+    int width;
+    int active;
+    struct lookup_req *queue; // ring buffer of lookups waiting for a slot
+    size_t capacity, head, count;
+};
+
+// Returns 0, or -1 when out of memory. width is the number of lookups in
+// flight, ENGINE_WIDTH when 0; capacity the number that can wait.
+int engine_init(struct lookup_engine *e, struct node *root, int width, size_t capacity);
+void engine_destroy(struct lookup_engine *e);
+
+// Queues a lookup. Returns FALSE when the queue is full; engine_step() makes
+// room.
+bool engine_submit(struct lookup_engine *e, avl_key_t key,
+                   void (*done)(void *ctx, avl_key_t key, struct node *ptr), void *ctx);
+
+// Starts queued lookups in the free slots and resumes every lookup in flight
+// once. Returns the number of lookups that finished.
+size_t engine_step(struct lookup_engine *e);
+
+// Steps until no lookup is in flight or queued. Returns the number finished.
+size_t engine_run(struct lookup_engine *e);
+
+#endif
@@ -0,0 +1,168 @@
+// Frozen trees, see avl_frozen.h.
+
+#include <string.h>
+#include "avl_frozen.h"
+
+#if defined(AVL_INT_KEYS) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
+#define FROZEN_NONE ((size_t)-1)
+
+void frozen_init(struct frozen_tree *ft)
+{
+    ft->keys = NULL;
+    ft->values = NULL;
+    ft->count = 0;
+    ft->nblocks = 0;
+}
+
+void frozen_destroy(struct frozen_tree *ft)
+{
+    free(ft->keys);
+    free(ft->values);
+    frozen_init(ft);
+}
+
+// Fills node k and the nodes below it in in-order, taking the keys from the
+// cursor. Once the tree runs out, the largest key is repeated.
+static void freeze_fill(struct frozen_tree *ft, size_t k, struct avl_cursor *cur, const struct node **last)
+{
+    const struct node *ptr;
+    size_t i;
+
+    if (k >= ft->nblocks)
+        return;
+    for (i = 0; i < FROZEN_B; i++)
+    {
+        freeze_fill(ft, FROZEN_CHILD(k, i), cur, last);
+        if ((ptr = cursor_node(cur)) != NULL)
+        {
+            *last = ptr;
+            cursor_next(cur);
+        }
+        ft->keys[k * FROZEN_B + i] = (*last)->data;
+        ft->values[k * FROZEN_B + i] = (*last)->value;
+    }
+    freeze_fill(ft, FROZEN_CHILD(k, FROZEN_B), cur, last);
+}
+
+bool avl_freeze(struct frozen_tree *ft, const struct avl_tree *avl)
+{
+    struct avl_cursor cur;
+    const struct node *last = NULL;
+    void *keys;
+
+    frozen_destroy(ft);
+    if (avl->count == 0)
+        return (TRUE);
+    ft->nblocks = (avl->count + FROZEN_B - 1) / FROZEN_B;
+    // Aligned so that each node of int keys is exactly one cache line
+    if (posix_memalign(&keys, 64, ft->nblocks * FROZEN_B * sizeof(avl_key_t)) != 0)
+    {
+        frozen_init(ft);
+        return (FALSE);
+    }
+    ft->keys = (avl_key_t *)keys;
+    ft->values = (avl_value_t *)malloc(ft->nblocks * FROZEN_B * sizeof(avl_value_t));
+    if (ft->values == NULL)
+    {
+        frozen_destroy(ft);
+        return (FALSE);
+    }
+    ft->count = avl->count;
+    cursor_first(avl->root, &cur);
+    freeze_fill(ft, 0, &cur, &last);
+    return (TRUE);
+}
+
+// Number of keys in the node that are smaller than data, which is where the
+// search goes on: below child i, with key i as the smallest key not below
+// data that it has seen so far
+static inline size_t frozen_rank(const avl_key_t *node, avl_key_t data)
+{
+#if defined(AVL_INT_KEYS) && defined(__AVX2__)
+    __m256i x = _mm256_set1_epi32(data);
+    __m256i lo = _mm256_cmpgt_epi32(x, _mm256_load_si256((const __m256i *)node));
+    __m256i hi = _mm256_cmpgt_epi32(x, _mm256_load_si256((const __m256i *)(node + 8)));
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(lo)) |
+                    (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+    return ((size_t)__builtin_popcount(mask));
+#elif defined(AVL_INT_KEYS) && defined(__SSE2__)
+    __m128i x = _mm_set1_epi32(data);
+    unsigned mask = 0;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        mask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(
+                    _mm_cmpgt_epi32(x, _mm_load_si128((const __m128i *)(node + 4 * i))))) << (4 * i);
+    return ((size_t)__builtin_popcount(mask));
+#else
+    size_t i, rank = 0;
+
+    for (i = 0; i < FROZEN_B; i++)
+        rank += (KEY_CMP(node[i], data) < 0);
+    return (rank);
+#endif
+}
+
+const avl_value_t *frozen_search(const struct frozen_tree *ft, avl_key_t data)
+{
+    size_t k = 0, i, found = FROZEN_NONE;
+
+    while (k < ft->nblocks)
+    {
+        i = frozen_rank(&ft->keys[k * FROZEN_B], data);
+        if (i < FROZEN_B)
+            found = k * FROZEN_B + i;
+        k = FROZEN_CHILD(k, i);
+    }
+    if (found != FROZEN_NONE && KEY_CMP(ft->keys[found], data) == 0)
+        return (&ft->values[found]);
+    return (NULL);
+}
+
+size_t frozen_search_batch(const struct frozen_tree *ft, const avl_key_t *keys, size_t n, const avl_value_t **out)
+{
+    size_t node[FROZEN_BATCH], found[FROZEN_BATCH];
+    size_t base, m, j, i, k, hits = 0;
+    int levels = 0, level;
+
+    // The tree is full down to its last level, so every search ends on that
+    // level or the one above it, and a group goes down side by side
+    for (k = 0; k < ft->nblocks; k = FROZEN_CHILD(k, 0))
+        levels++;
+    for (base = 0; base < n; base += m)
+    {
+        m = (n - base < FROZEN_BATCH) ? n - base : FROZEN_BATCH;
+        for (j = 0; j < m; j++)
+        {
+            node[j] = 0;
+            found[j] = FROZEN_NONE;
+        }
+        for (level = 0; level < levels; level++)
+        {
+            for (j = 0; j < m; j++)
+            {
+                if (node[j] >= ft->nblocks)
+                    continue;
+                i = frozen_rank(&ft->keys[node[j] * FROZEN_B], keys[base + j]);
+                if (i < FROZEN_B)
+                    found[j] = node[j] * FROZEN_B + i;
+                node[j] = FROZEN_CHILD(node[j], i);
+                if (node[j] < ft->nblocks)
+                    __builtin_prefetch(&ft->keys[node[j] * FROZEN_B]);
+            }
+        }
+        for (j = 0; j < m; j++)
+        {
+            out[base + j] = NULL;
+            if (found[j] != FROZEN_NONE && KEY_CMP(ft->keys[found[j]], keys[base + j]) == 0)
+            {
+                out[base + j] = &ft->values[found[j]];
+                hits++;
+            }
+        }
+    }
+    return (hits);
+}
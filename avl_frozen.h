@@ -0,0 +1,56 @@
+// Frozen trees: a read-only copy of an AVL tree for key sets that stop
+// changing for a while.
+//
+// avl_freeze() lays the keys out as a static B-tree of FROZEN_B keys per
+// node, with no pointers at all: the nodes are numbered breadth-first, node k
+// holds keys[k * FROZEN_B] .. keys[k * FROZEN_B + FROZEN_B - 1] in order, and
+// its children are nodes k * (FROZEN_B + 1) + 1 .. k * (FROZEN_B + 1) +
+// FROZEN_B + 1. With int keys a node is one 64-byte cache line, so a search
+// of 10^6 keys touches 5 lines where search() touches about 20 nodes spread
+// over the heap. The position of a key within a node is found with SSE2
+// compares, or AVX2 when the library is built with -mavx2 (or
+// -march=native); other key types compare one key at a time.
+//
+// The key slots are filled in in-order, and the trailing slots of that order
+// are padded with copies of the largest key and its value, so every node is
+// full and a search never has to check the count. The padding usually lies
+// in the root or other inner nodes rather than in the last node: with 33
+// keys, slots 1 to 15 of node 0 hold the copies.
+
+#ifndef AVL_FROZEN_H
+#define AVL_FROZEN_H
+
+#include "avl_tree.h"
+
+#define FROZEN_B (16)
+#define FROZEN_CHILD(k, i) ((k) * (FROZEN_B + 1) + (i) + 1)
+
+// Searches that frozen_search_batch() keeps in flight at once
+#define FROZEN_BATCH (16)
+
+struct frozen_tree
+{
+    avl_key_t *keys;     // nblocks * FROZEN_B keys, aligned to a cache line
+    avl_value_t *values; // the value of keys[i] is values[i]
+    size_t count;        // keys in the tree, without the copies of the largest key
+    size_t nblocks;      // nodes of FROZEN_B keys
+};
+
+// Replaces the contents of ft by the keys and values of the tree, in O(n)
+// time. Returns FALSE when out of memory. The frozen copy does not change
+// when the tree does.
+bool avl_freeze(struct frozen_tree *ft, const struct avl_tree *avl);
+void frozen_init(struct frozen_tree *ft);
+void frozen_destroy(struct frozen_tree *ft);
+
+// Returns the value stored with data, or NULL when data is not in the tree
+const avl_value_t *frozen_search(const struct frozen_tree *ft, avl_key_t data);
+
+// Looks up keys[0] .. keys[n - 1] and sets out[i] as frozen_search() would
+// return it for keys[i]. FROZEN_BATCH searches go down the tree side by side,
+// each prefetching its next node while the others compare, so their cache
+// misses overlap instead of following one another. Returns the number of keys
+// found.
+size_t frozen_search_batch(const struct frozen_tree *ft, const avl_key_t *keys, size_t n, const avl_value_t **out);
+
+#endif
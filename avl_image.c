@@ -0,0 +1,272 @@
+// On-disk snapshots, see avl_image.h.
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "avl_image.h"
+
+#ifndef AVL_STRING_KEYS
+
+#define FNV_OFFSET (0xcbf29ce484222325ull)
+#define FNV_PRIME (0x100000001b3ull)
+
+// FNV-1a taken over 64-bit words instead of bytes, so that it costs one
+// multiplication per 8 bytes. Each step is a bijection of the running value,
+// so a change anywhere in the data is never cancelled out later.
+static uint64_t image_checksum(uint64_t h, const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * FNV_PRIME;
+    }
+    for (; i < n; i++)
+        h = (h ^ p[i]) * FNV_PRIME;
+    return (h);
+}
+
+static uint64_t header_checksum(const struct image_header *header, const struct cnode *nodes)
+{
+    struct image_header copy = *header;
+
+    copy.checksum = 0;
+    return (image_checksum(image_checksum(FNV_OFFSET, &copy, sizeof(copy)), nodes,
+                           ((size_t)header->count + 1) * sizeof(struct cnode)));
+}
+
+int avl_save(const struct avl_tree *avl, const char *path)
+{
+    struct compact_tree ct;
+    struct image_header header;
+    char *tmp;
+    FILE *out;
+    int ok, saved;
+
+    // compact_from_tree() lays the nodes out in pre-order, which is the
+    // layout of the file
+    compact_init(&ct);
+    if (avl->count > CNODE_MAX || !compact_from_tree(&ct, avl))
+    {
+        compact_destroy(&ct);
+        errno = (avl->count > CNODE_MAX) ? EFBIG : ENOMEM;
+        return (-1);
+    }
+    memset(&ct.nodes[CNODE_NIL], 0, sizeof(struct cnode));
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.key_size = sizeof(avl_key_t);
+    header.value_size = sizeof(avl_value_t);
+    header.node_size = sizeof(struct cnode);
+    header.count = ct.count;
+    header.root = ct.root;
+    header.checksum = header_checksum(&header, ct.nodes);
+
+    tmp = (char *)malloc(strlen(path) + 5);
+    if (tmp == NULL)
+    {
+        compact_destroy(&ct);
+        errno = ENOMEM;
+        return (-1);
+    }
+    strcpy(tmp, path);
+    strcat(tmp, ".tmp");
+    out = fopen(tmp, "wb");
+    ok = (out != NULL);
+    ok = ok && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(ct.nodes, sizeof(struct cnode), (size_t)ct.count + 1, out) == (size_t)ct.count + 1;
+    ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    if (out != NULL && fclose(out) != 0)
+        ok = 0;
+    ok = ok && rename(tmp, path) == 0;
+    saved = errno;
+    if (!ok)
+        remove(tmp);
+    free(tmp);
+    compact_destroy(&ct);
+    errno = saved;
+    return (ok ? 0 : -1);
+}
+
+// In pre-order the left child of node i, if any, is node i + 1, and the right
+// child comes after the whole left sub-tree
+static bool image_check_links(const struct cnode *nodes, uint32_t count)
+{
+    uint32_t i, right;
+
+    for (i = 1; i <= count; i++)
+    {
+        right = CNODE_RIGHT(&nodes[i]);
+        if (nodes[i].left != CNODE_NIL && (nodes[i].left != i + 1 || i == count))
+            return (FALSE);
+        if (right != CNODE_NIL && (right <= i || right > count))
+            return (FALSE);
+        if (CNODE_BALANCE(&nodes[i]) > 1)
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+int image_open(struct avl_image *img, const char *path)
+{
+    const struct image_header *header;
+    struct stat st;
+    void *map;
+    int fd, error = 0;
+
+    memset(img, 0, sizeof(*img));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (-1);
+    if (fstat(fd, &st) != 0)
+    {
+        error = errno;
+        close(fd);
+        errno = error;
+        return (-1);
+    }
+    if ((size_t)st.st_size < sizeof(struct image_header))
+    {
+        close(fd);
+        errno = EINVAL;
+        return (-1);
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    error = (map == MAP_FAILED) ? errno : 0; // errno is left over from before when mmap() succeeds
+    close(fd); // the mapping stays valid without the descriptor
+    if (map == MAP_FAILED)
+    {
+        errno = error;
+        return (-1);
+    }
+
+    header = (const struct image_header *)map;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != IMAGE_VERSION ||
+        header->byte_order != IMAGE_BYTE_ORDER || header->key_size != sizeof(avl_key_t) ||
+        header->value_size != sizeof(avl_value_t) || header->node_size != sizeof(struct cnode) ||
+        header->count > CNODE_MAX || header->root != (header->count > 0 ? 1 : CNODE_NIL) ||
+        (size_t)st.st_size != sizeof(struct image_header) + ((size_t)header->count + 1) * sizeof(struct cnode))
+        error = EINVAL;
+    else if (header_checksum(header, (const struct cnode *)(header + 1)) != header->checksum)
+        error = EBADMSG;
+    else if (!image_check_links((const struct cnode *)(header + 1), header->count))
+        error = EINVAL;
+    if (error != 0)
+    {
+        munmap(map, (size_t)st.st_size);
+        errno = error;
+        return (-1);
+    }
+    img->map = map;
+    img->length = (size_t)st.st_size;
+    img->nodes = (const struct cnode *)(header + 1);
+    img->root = header->root;
+    img->count = header->count;
+    return (0);
+}
+
+void image_close(struct avl_image *img)
+{
+    if (img->map != NULL)
+        munmap(img->map, img->length);
+    memset(img, 0, sizeof(*img));
+}
+
+const struct cnode *image_search(const struct avl_image *img, avl_key_t data)
+{
+    const struct cnode *nodes = img->nodes;
+    uint32_t idx = img->root;
+    int cmp;
+
+    while (idx != CNODE_NIL)
+    {
+        cmp = KEY_CMP(data, nodes[idx].data);
+        if (cmp == 0)
+            return (&nodes[idx]);
+        idx = (cmp < 0) ? nodes[idx].left : CNODE_RIGHT(&nodes[idx]);
+    }
+    return (NULL);
+}
+
+// Walks the nodes of a snapshot in order for avl_build_stream(). The links
+// have been checked to point forward, but not that the tree is balanced, so
+// the walk gives up when it gets deeper than any AVL tree can be.
+struct image_walk
+{
+    const struct cnode *nodes;
+    uint32_t path[AVL_MAX_HEIGHT];
+    int depth;
+    uint32_t idx; // next node to descend from, or CNODE_NIL
+    bool broken;
+};
+
+static bool image_next(void *ctx, avl_key_t *data, avl_value_t *value)
+{
+    struct image_walk *w = (struct image_walk *)ctx;
+    const struct cnode *ptr;
+
+    for (; w->idx != CNODE_NIL; w->idx = w->nodes[w->idx].left)
+    {
+        if (w->depth == AVL_MAX_HEIGHT)
+        {
+            w->broken = TRUE;
+            return (FALSE);
+        }
+        w->path[w->depth++] = w->idx;
+    }
+    if (w->depth == 0)
+        return (FALSE);
+    ptr = &w->nodes[w->path[--w->depth]];
+    *data = ptr->data;
+    *value = ptr->value;
+    w->idx = CNODE_RIGHT(ptr);
+    return (TRUE);
+}
+
+int image_to_tree(struct avl_tree *avl, const struct avl_image *img)
+{
+    struct image_walk walk;
+
+    walk.nodes = img->nodes;
+    walk.depth = 0;
+    walk.idx = img->root;
+    walk.broken = FALSE;
+    // Keys out of order fail the build, duplicates are skipped and show up in
+    // the count
+    if (avl_build_stream(avl, img->count, image_next, &walk) != 0)
+        return (-1);
+    if (walk.broken || avl->count != img->count)
+    {
+        avl_destroy(avl);
+        return (-1);
+    }
+    return (0);
+}
+
+int image_to_compact(struct compact_tree *ct, const struct avl_image *img)
+{
+    compact_destroy(ct);
+    if (!compact_reserve(ct, img->count))
+        return (-1);
+    memcpy(ct->nodes, img->nodes, ((size_t)img->count + 1) * sizeof(struct cnode));
+    ct->root = img->root;
+    ct->count = img->count;
+    ct->used = img->count + 1;
+    if (!compact_validate(ct))
+    {
+        compact_destroy(ct);
+        return (-1);
+    }
+    return (0);
+}
+
+#endif
@@ -0,0 +1,80 @@
+// On-disk snapshots of an AVL tree.
+//
+// avl_save() writes the tree in the compact layout of avl_tree.h: a header
+// followed by the nodes as struct cnode entries, in pre-order, with 32-bit
+// child indices instead of pointers. image_open() maps such a file read-only
+// with one mmap() and checks it, after which image_search() runs directly on
+// the mapped nodes, without a single allocation. image_to_tree() and
+// image_to_compact() turn a snapshot back into a tree that can be changed,
+// in O(n) time.
+//
+// The nodes are stored as they are in memory, so a snapshot can only be read
+// by a build with the same key and value types and the same byte order; the
+// header records these and image_open() refuses files that differ. Keys and
+// values must be plain data: with AVL_STRING_KEYS, or any other pointer key,
+// only the pointers would be saved, so this part of the library is left out.
+
+#ifndef AVL_IMAGE_H
+#define AVL_IMAGE_H
+
+#include "avl_tree.h"
+
+#ifndef AVL_STRING_KEYS
+
+#define IMAGE_MAGIC "AVLTREE"      // 8 bytes with the NUL
+#define IMAGE_VERSION (1)          // raised whenever the layout changes
+#define IMAGE_BYTE_ORDER (0x01020304u) // reads back differently on the other byte order
+
+// The nodes follow the header directly. nodes[0] is the empty sub-tree as in
+// a compact_tree, so the file holds count + 1 of them and the root is node 1.
+struct image_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t key_size;   // sizeof(avl_key_t)
+    uint32_t value_size; // sizeof(avl_value_t)
+    uint32_t node_size;  // sizeof(struct cnode)
+    uint32_t count;      // nodes in the tree
+    uint32_t root;       // 1, or CNODE_NIL for an empty tree
+    uint32_t reserved;   // 0
+    uint64_t checksum;   // of the header with this field 0, then of the nodes
+};
+
+// A snapshot mapped into memory. nodes points into the mapping, which is
+// read-only.
+struct avl_image
+{
+    void *map;
+    size_t length; // bytes mapped
+    const struct cnode *nodes;
+    uint32_t root;
+    uint32_t count;
+};
+
+// Writes the tree to path, through a temporary file next to it that is
+// renamed over path once it is complete, so a crash never leaves half a
+// snapshot behind. Returns 0, or -1 with errno set.
+int avl_save(const struct avl_tree *avl, const char *path);
+
+// Maps the snapshot at path and checks its header, its checksum and that
+// every child index points further into the file, which is what keeps a
+// search from running in circles. Returns 0, or -1 with errno set: EINVAL
+// for a file that is not a snapshot of this build, EBADMSG for a checksum
+// that does not match.
+int image_open(struct avl_image *img, const char *path);
+void image_close(struct avl_image *img);
+
+// Returns the node holding data, or NULL. The node lives in the mapping and
+// is valid until image_close().
+const struct cnode *image_search(const struct avl_image *img, avl_key_t data);
+
+// Rebuild a tree from the snapshot, with avl_build_stream() and with one
+// copy of the node array. Both return 0, or -1 when out of memory or when the
+// keys are not in order; the tree is left empty then.
+int image_to_tree(struct avl_tree *avl, const struct avl_image *img);
+int image_to_compact(struct compact_tree *ct, const struct avl_image *img);
+
+#endif
+
+#endif
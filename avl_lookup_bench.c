@@ -0,0 +1,145 @@
+// Lookups in the live tree, one at a time and batched, against the read-only
+// layouts.
+//
+// Build: make avl_lookup_bench
+//        (add -mavx2 or -march=native to CFLAGS for the AVX2 node search)
+// Run:   ./avl_lookup_bench [max_n] > results.csv
+//
+// For n = 10^3, 10^4, ... up to max_n (10^7 by default, which is past the
+// last-level cache of most machines) the tree is loaded with n random keys,
+// frozen with avl_freeze(), and n lookups of keys in the tree, in random
+// order, are timed in each way:
+//   search        search() on the tree
+//   search_batch  search_batch() on the tree, in groups of LOOKUP_GROUP keys
+//   engine        the lookup engine of avl_engine.h, ENGINE_WIDTH lookups in
+//                 flight, with every key submitted as a lookup of its own
+//   frozen        frozen_search() on the frozen copy
+//   frozen_batch  frozen_search_batch() on the frozen copy, all n at once
+// One CSV line per size gives the time per lookup of each and the speedup of
+// the others over search().
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "avl_frozen.h"
+#include "avl_engine.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_lookup_bench.c needs the default int keys"
+#endif
+
+#define LOOKUP_GROUP (32) // keys a caller has at hand at once
+
+void count_hit(void *ctx, avl_key_t key, struct node *ptr)
+{
+    *(size_t *)ctx += (ptr != NULL);
+}
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+uint64_t rng_state = 88172645463325252ull;
+
+uint64_t rng_next(void) // xorshift64*
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ull);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_n = (argc > 1) ? (size_t)strtod(argv[1], NULL) : 10000000;
+    struct avl_tree avl;
+    struct frozen_tree ft;
+    struct lookup_engine engine;
+    const avl_value_t **out;
+    struct node **found;
+    double t0, t_search, t_search_batch, t_engine, t_frozen, t_batch;
+    size_t n, i, j, hits;
+    int *keys, tmp;
+    bool inserted;
+
+    keys = (int *)malloc(max_n * sizeof(int));
+    out = (const avl_value_t **)malloc(max_n * sizeof(*out));
+    found = (struct node **)malloc(max_n * sizeof(*found));
+    if (max_n == 0 || keys == NULL || out == NULL || found == NULL)
+    {
+        fprintf(stderr, "usage: %s [max_n]\n", argv[0]);
+        return (1);
+    }
+    frozen_init(&ft);
+
+    printf("n,search_ns,search_batch_ns,engine_ns,frozen_ns,frozen_batch_ns,search_batch_speedup,"
+           "engine_speedup,frozen_speedup,frozen_batch_speedup\n");
+    for (n = 1000; n <= max_n; n *= 10)
+    {
+        fprintf(stderr, "n = %zu\n", n);
+        avl_init(&avl);
+        for (i = 0; i < n;)
+        {
+            keys[i] = (int)(rng_next() >> 33);
+            insert(&avl, keys[i], &inserted)->value = keys[i];
+            i += inserted;
+        }
+        if (!avl_freeze(&ft, &avl))
+        {
+            fprintf(stderr, "Out of memory\n");
+            return (1);
+        }
+        for (i = n - 1; i > 0; i--) // look the keys up in another order
+        {
+            j = rng_next() % (i + 1);
+            tmp = keys[i];
+            keys[i] = keys[j];
+            keys[j] = tmp;
+        }
+
+        hits = 0;
+        t0 = now_ns();
+        for (i = 0; i < n; i++)
+            hits += (search(avl.root, keys[i]) != NULL);
+        t_search = (now_ns() - t0) / n;
+        t0 = now_ns();
+        for (i = 0; i < n; i += LOOKUP_GROUP)
+            hits += search_batch(avl.root, keys + i, (n - i < LOOKUP_GROUP) ? n - i : LOOKUP_GROUP, found + i);
+        t_search_batch = (now_ns() - t0) / n;
+        if (engine_init(&engine, avl.root, ENGINE_WIDTH, 4 * ENGINE_WIDTH) != 0)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return (1);
+        }
+        t0 = now_ns();
+        for (i = 0; i < n; i++)
+            while (!engine_submit(&engine, keys[i], count_hit, &hits))
+                engine_step(&engine);
+        engine_run(&engine);
+        t_engine = (now_ns() - t0) / n;
+        engine_destroy(&engine);
+        t0 = now_ns();
+        for (i = 0; i < n; i++)
+            hits += (frozen_search(&ft, keys[i]) != NULL);
+        t_frozen = (now_ns() - t0) / n;
+        t0 = now_ns();
+        hits += frozen_search_batch(&ft, keys, n, out);
+        t_batch = (now_ns() - t0) / n;
+        if (hits != 5 * n)
+            fprintf(stderr, "%zu of %zu lookups found their key\n", hits, 5 * n);
+
+        printf("%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f\n", n, t_search, t_search_batch, t_engine,
+               t_frozen, t_batch, t_search / t_search_batch, t_search / t_engine, t_search / t_frozen,
+               t_search / t_batch);
+        fflush(stdout);
+        avl_destroy(&avl);
+    }
+    frozen_destroy(&ft);
+    free(keys);
+    free(out);
+    free(found);
+    return (0);
+}
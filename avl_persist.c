@@ -0,0 +1,202 @@
+// Persistent AVL trees by path copying, see avl_persist.h.
+//
+// An update first copies the nodes on its path, so the links it rewrites all
+// belong to nodes that no other version can see. insert_rebalance() and
+// delete_rebalance() of avl_tree.c then work on the copies as they would on
+// a tree of its own; delete_rebalance() is given copy_node() to copy the
+// nodes next to the path that its rotations move.
+
+#include <string.h>
+#include "avl_persist.h"
+
+// The copies are taken from the pool before anything is changed, so that
+// running out of memory leaves no half-built version behind
+struct copier
+{
+    struct avl_arena *arena;
+    struct node *spare[PERSIST_MAX_COPIES];
+    int nspare; // nodes left in spare[]
+};
+
+void arena_init(struct avl_arena *arena)
+{
+    pool_init(&arena->pool);
+    memset(&arena->stats, 0, sizeof(arena->stats));
+    arena->retire = NULL;
+    arena->retire_ctx = NULL;
+}
+
+// Frees the nodes of every version at once
+void arena_destroy(struct avl_arena *arena)
+{
+    pool_destroy(&arena->pool);
+}
+
+// Takes n nodes from the pool. Either all of them are taken or none is.
+static bool copier_fill(struct copier *c, struct avl_arena *arena, int n)
+{
+    struct node *ptr;
+
+    c->arena = arena;
+    for (c->nspare = 0; c->nspare < n; c->nspare++)
+    {
+        ptr = pool_alloc(&arena->pool);
+        if (ptr == NULL)
+        {
+            while (c->nspare > 0)
+                pool_free(&arena->pool, c->spare[--c->nspare]);
+            return (FALSE);
+        }
+        c->spare[c->nspare] = ptr;
+    }
+    arena->stats.allocations += n;
+    return (TRUE);
+}
+
+// Gives the copies that were not needed back to the pool
+static void copier_drain(struct copier *c)
+{
+    c->arena->stats.allocations -= c->nspare;
+    while (c->nspare > 0)
+        pool_free(&c->arena->pool, c->spare[--c->nspare]);
+}
+
+static void retire_node(struct avl_arena *arena, struct node *ptr)
+{
+    if (arena->retire != NULL)
+        arena->retire(arena->retire_ctx, ptr);
+}
+
+// Returns a private copy of ptr, which the new version no longer uses
+static struct node *copy_node(void *ctx, struct node *ptr)
+{
+    struct copier *c = (struct copier *)ctx;
+    struct node *copy = c->spare[--c->nspare];
+
+    *copy = *ptr;
+    retire_node(c->arena, ptr);
+    return (copy);
+}
+
+struct node *persistent_insert(struct avl_arena *arena, struct node *root, avl_key_t data,
+                               avl_value_t value, bool *inserted)
+{
+    struct copier copier;
+    struct node *orig[AVL_MAX_HEIGHT];
+    struct node **path[AVL_MAX_HEIGHT + 1];
+    bool went_left[AVL_MAX_HEIGHT];
+    struct node *ptr, *copy, **link;
+    int depth = 0, i, cmp;
+
+    *inserted = FALSE;
+    // Find where the new leaf goes
+    for (ptr = root; ptr != NULL; depth++)
+    {
+        cmp = KEY_CMP(data, ptr->data);
+        if (cmp == 0)
+            break;
+        orig[depth] = ptr;
+        went_left[depth] = (cmp < 0);
+        ptr = (cmp < 0) ? ptr->left : ptr->right;
+    }
+    arena->stats.comparisons += depth + (ptr != NULL);
+    if (depth > arena->stats.max_depth)
+        arena->stats.max_depth = depth;
+    if (ptr != NULL)
+        return (root); // the value is already in the tree
+    if (!copier_fill(&copier, arena, depth + 1))
+        return (NULL);
+
+    // Copy the path and hang the new leaf below the copies. The rotations of
+    // an insertion only move nodes on the path, so these are all the copies
+    // it needs.
+    link = &root;
+    for (i = 0; i < depth; i++)
+    {
+        copy = copy_node(&copier, orig[i]);
+#ifdef AVL_ORDER_STATS
+        copy->size++;
+#endif
+        path[i] = link;
+        *link = copy;
+        link = went_left[i] ? &copy->left : &copy->right;
+    }
+    ptr = copier.spare[--copier.nspare];
+    ptr->data = data;
+    ptr->value = value;
+    ptr->left = NULL;
+    ptr->right = NULL;
+    ptr->balance = 0;
+#ifdef AVL_ORDER_STATS
+    ptr->size = 1;
+#endif
+    *link = ptr;
+    path[depth] = link;
+    insert_rebalance(path, depth, &arena->stats);
+    *inserted = TRUE;
+    return (root);
+}
+
+struct node *persistent_delete(struct avl_arena *arena, struct node *root, avl_key_t data, bool *deleted)
+{
+    struct copier copier;
+    struct node *orig[AVL_MAX_HEIGHT];
+    struct node **path[AVL_MAX_HEIGHT + 1];
+    bool went_left[AVL_MAX_HEIGHT];
+    struct node *ptr, *copy, *target, **link;
+    int depth = 0, i, cmp;
+
+    *deleted = FALSE;
+    for (ptr = root; ptr != NULL && (cmp = KEY_CMP(data, ptr->data)) != 0; depth++)
+    {
+        orig[depth] = ptr;
+        went_left[depth] = (cmp < 0);
+        ptr = (cmp < 0) ? ptr->left : ptr->right;
+    }
+    arena->stats.comparisons += depth + (ptr != NULL);
+    if (ptr == NULL)
+        return (root); // there is nothing to delete
+    target = ptr;
+    if (ptr->left && ptr->right)
+    {
+        // The in-order predecessor is unlinked instead, and the copy of the
+        // target takes over its data. The target is on the path to it.
+        orig[depth] = ptr;
+        went_left[depth++] = TRUE;
+        for (ptr = ptr->left; ptr->right != NULL; ptr = ptr->right)
+        {
+            orig[depth] = ptr;
+            went_left[depth++] = FALSE;
+        }
+    }
+    if (depth > arena->stats.max_depth)
+        arena->stats.max_depth = depth;
+    if (!copier_fill(&copier, arena, 3 * depth))
+        return (root);
+
+    link = &root;
+    for (i = 0; i < depth; i++)
+    {
+        copy = copy_node(&copier, orig[i]);
+        if (orig[i] == target)
+        {
+            copy->data = ptr->data;
+            copy->value = ptr->value;
+        }
+#ifdef AVL_ORDER_STATS
+        copy->size--;
+#endif
+        path[i] = link;
+        *link = copy;
+        link = went_left[i] ? &copy->left : &copy->right;
+    }
+    // The unlinked node has at most one child, which takes its place. The
+    // node itself is left to the old versions.
+    *link = (ptr->left != NULL) ? ptr->left : ptr->right;
+    path[depth] = link;
+    retire_node(arena, ptr);
+    delete_rebalance(path, depth, &arena->stats, copy_node, &copier);
+    copier_drain(&copier);
+    *deleted = TRUE;
+    return (root);
+}
@@ -0,0 +1,46 @@
+// Persistent AVL trees. persistent_insert() and persistent_delete() leave the
+// tree they are given as it was and return the root of a new version, which
+// shares every sub-tree the update did not touch with the old one. An update
+// copies the nodes on its path and the few that its rotations move, so it
+// costs at most 3 * height + 1 new nodes, and any root that was returned
+// stays a consistent snapshot that can be read with search(), the cursors or
+// range_scan() while later versions are made.
+//
+// The nodes of all versions come from one arena. By default a replaced node
+// is kept until the arena is destroyed, so snapshots cost nothing to take or
+// to drop. An owner that knows when a node can no longer be reached, like the
+// RCU tree of avl_rcu.h, sets retire and frees the replaced nodes itself.
+
+#ifndef AVL_PERSIST_H
+#define AVL_PERSIST_H
+
+#include "avl_tree.h"
+
+// Copies a single update can make: one per node on the path, and two for
+// each rotation of a deletion
+#define PERSIST_MAX_COPIES (3 * AVL_MAX_HEIGHT + 1)
+
+struct avl_arena
+{
+    struct node_pool pool;
+    struct avl_stats stats;
+    // Called with every node that a new version replaces, or NULL to keep them
+    void (*retire)(void *ctx, struct node *ptr);
+    void *retire_ctx;
+};
+
+void arena_init(struct avl_arena *arena);
+void arena_destroy(struct avl_arena *arena);
+
+// Returns the root of the new version, in which data has value, and sets
+// *inserted. When data was already there root itself is returned and
+// *inserted is FALSE. Returns NULL when the arena is out of memory.
+struct node *persistent_insert(struct avl_arena *arena, struct node *root, avl_key_t data,
+                               avl_value_t value, bool *inserted);
+
+// Returns the root of the version without data, which is NULL when that
+// version is empty, and sets *deleted. When data is not in the tree, or the
+// arena is out of memory, root itself is returned and *deleted is FALSE.
+struct node *persistent_delete(struct avl_arena *arena, struct node *root, avl_key_t data, bool *deleted);
+
+#endif
@@ -0,0 +1,147 @@
+// Strict against relaxed balancing under write-heavy churn.
+//
+// Build: make avl_policy_bench avl_policy_bench_relaxed
+// Run:   (./avl_policy_bench; ./avl_policy_bench_relaxed | tail -n +2) > results.csv
+//
+// The balancing policy is fixed at compile time, so the same program is built
+// twice: avl_policy_bench with the default strict AVL balance and
+// avl_policy_bench_relaxed with -DAVL_RELAXED. For n = 10^4, 10^5, ... up to
+// max_n (10^6 by default) the tree is loaded with n random keys and churned
+// with n updates, each deleting a random key of the tree and inserting a new
+// one, so the size stays n. Then n random keys of the tree are looked up,
+// avl_rebalance() is run (it does nothing under the strict policy) and the
+// lookups are repeated. Each n gives one CSV line with the time and the
+// rotations per update, and for the lookups before and after the rebalance
+// pass the time per lookup, the average number of nodes compared for a key
+// that is found, and the height.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "avl_tree.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_policy_bench.c needs the default int keys"
+#endif
+
+#ifdef AVL_RELAXED
+#define POLICY "relaxed"
+#else
+#define POLICY "strict"
+#endif
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+uint64_t rng_state = 88172645463325252ull;
+
+uint64_t rng(void) // xorshift64*
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ull);
+}
+
+size_t rotations(const struct avl_stats *st)
+{
+    return (st->rot_ll + st->rot_lr + st->rot_rr + st->rot_rl + st->rot_r0 + st->rot_r1 + st->rot_rm1 +
+            st->rot_l0 + st->rot_l1 + st->rot_lm1);
+}
+
+// Sum of the depths of all nodes below ptr, the root counting as 1, which is
+// the number of nodes compared when each of them is looked up once
+size_t path_length(const struct node *ptr, size_t depth)
+{
+    if (ptr == NULL)
+        return (0);
+    return (depth + path_length(ptr->left, depth + 1) + path_length(ptr->right, depth + 1));
+}
+
+// Looks up n random keys of the tree and returns the time per lookup
+double lookups(struct avl_tree *avl, const int *keys, size_t n, size_t *found)
+{
+    double t0 = now_ns();
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        *found += (search(avl->root, keys[rng() % n]) != NULL);
+    return ((now_ns() - t0) / n);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_n = (argc > 1) ? (size_t)strtod(argv[1], NULL) : 1000000;
+    struct avl_tree avl;
+    double t0, write_ns, search_ns, rebalance_ms, after_ns;
+    size_t n, i, j, rot, found = 0;
+    bool inserted;
+    int *keys, key, height;
+
+    keys = (int *)malloc(max_n * sizeof(int));
+    if (max_n < 10000 || keys == NULL)
+    {
+        fprintf(stderr, "usage: %s [max_n], max_n at least 10000\n", argv[0]);
+        return (1);
+    }
+
+    printf("policy,n,write_ns,rotations_per_write,search_ns,avg_compares,height,rebalance_ms,"
+           "rebalanced_search_ns,rebalanced_avg_compares,rebalanced_height\n");
+    for (n = 10000; n <= max_n; n *= 10)
+    {
+        fprintf(stderr, "%s with %zu keys\n", POLICY, n);
+        avl_init(&avl);
+        for (i = 0; i < n;)
+        {
+            key = (int)(rng() >> 33);
+            if (insert(&avl, key, &inserted) == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                return (1);
+            }
+            if (inserted)
+                keys[i++] = key;
+        }
+
+        rot = rotations(&avl.stats);
+        t0 = now_ns();
+        for (i = 0; i < n;)
+        {
+            key = (int)(rng() >> 33);
+            if (insert(&avl, key, &inserted) == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                return (1);
+            }
+            if (!inserted)
+                continue;
+            j = rng() % n;
+            delete(&avl, keys[j]);
+            keys[j] = key;
+            i++;
+        }
+        write_ns = (now_ns() - t0) / (2 * n);
+        rot = rotations(&avl.stats) - rot;
+
+        search_ns = lookups(&avl, keys, n, &found);
+        height = tree_height(avl.root);
+        printf("%s,%zu,%.1f,%.3f,%.1f,%.2f,%d,", POLICY, n, write_ns, (double)rot / (2 * n), search_ns,
+               (double)path_length(avl.root, 1) / n, height);
+
+        t0 = now_ns();
+        avl_rebalance(&avl);
+        rebalance_ms = (now_ns() - t0) / 1e6;
+        after_ns = lookups(&avl, keys, n, &found);
+        printf("%.2f,%.1f,%.2f,%d\n", rebalance_ms, after_ns, (double)path_length(avl.root, 1) / n,
+               tree_height(avl.root));
+        fflush(stdout);
+        avl_destroy(&avl);
+    }
+    fprintf(stderr, "%zu keys found\n", found);
+    free(keys);
+    return (0);
+}
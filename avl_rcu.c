@@ -0,0 +1,237 @@
+// Concurrent AVL tree with copy-on-write updates, see avl_rcu.h.
+//
+// The writers build each new version with persistent_insert() and
+// persistent_delete(). Every node the new version replaces is retired into a
+// queue, and the new root is published once the version is complete.
+
+#include <string.h>
+#include "avl_rcu.h"
+
+// Called by the persistent updates with every node the new version replaces.
+// The node is tagged with the epoch that is current while the new version is
+// built, readers in that epoch may still hold the old root.
+static void rcu_retire(void *ctx, struct node *ptr)
+{
+    struct rcu_tree *rt = (struct rcu_tree *)ctx;
+
+    rt->retired[rt->retired_tail].ptr = ptr;
+    rt->retired[rt->retired_tail].epoch = atomic_load_explicit(&rt->epoch, memory_order_relaxed);
+    rt->retired_tail++;
+}
+
+void rcu_init(struct rcu_tree *rt)
+{
+    int i;
+
+    atomic_init(&rt->root, NULL);
+    atomic_init(&rt->epoch, 1);
+    atomic_init(&rt->count, 0);
+    pthread_mutex_init(&rt->write_lock, NULL);
+    arena_init(&rt->arena);
+    rt->arena.retire = rcu_retire;
+    rt->arena.retire_ctx = rt;
+    rt->retired = NULL;
+    rt->retired_head = rt->retired_tail = rt->retired_capacity = 0;
+    for (i = 0; i < RCU_MAX_READERS; i++)
+    {
+        atomic_init(&rt->readers[i].epoch, 0);
+        atomic_init(&rt->readers[i].in_use, 0);
+    }
+}
+
+// Must only be called when no reader or writer uses the tree any more
+void rcu_destroy(struct rcu_tree *rt)
+{
+    arena_destroy(&rt->arena); // the retired nodes are in its pool too
+    free(rt->retired);
+    rt->retired = NULL;
+    rt->retired_head = rt->retired_tail = rt->retired_capacity = 0;
+    atomic_store(&rt->root, NULL);
+    atomic_store(&rt->count, 0);
+    pthread_mutex_destroy(&rt->write_lock);
+}
+
+struct rcu_reader *rcu_register(struct rcu_tree *rt)
+{
+    int i, expected;
+
+    for (i = 0; i < RCU_MAX_READERS; i++)
+    {
+        expected = 0;
+        if (atomic_compare_exchange_strong(&rt->readers[i].in_use, &expected, 1))
+            return (&rt->readers[i]);
+    }
+    return (NULL);
+}
+
+void rcu_unregister(struct rcu_reader *reader)
+{
+    atomic_store(&reader->epoch, 0);
+    atomic_store(&reader->in_use, 0);
+}
+
+// The slot is written before the root is read. A writer that still sees the
+// slot empty has published its root before it looked, so the reader gets the
+// new root and cannot reach the nodes the writer is about to free.
+void rcu_read_lock(struct rcu_tree *rt, struct rcu_reader *reader)
+{
+    atomic_store(&reader->epoch, atomic_load(&rt->epoch));
+}
+
+void rcu_read_unlock(struct rcu_reader *reader)
+{
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+struct node *rcu_root(struct rcu_tree *rt)
+{
+    return (atomic_load(&rt->root));
+}
+
+bool rcu_search(struct rcu_tree *rt, struct rcu_reader *reader, avl_key_t data, avl_value_t *value)
+{
+    struct node *ptr;
+
+    rcu_read_lock(rt, reader);
+    ptr = search(rcu_root(rt), data);
+    if (ptr != NULL && value != NULL)
+        *value = ptr->value;
+    rcu_read_unlock(reader);
+    return (ptr != NULL);
+}
+
+// Frees the retired nodes of every epoch that no active reader is in.
+// Called with write_lock held.
+static void reclaim(struct rcu_tree *rt)
+{
+    uint_fast64_t oldest = atomic_load(&rt->epoch), e;
+    int i;
+
+    for (i = 0; i < RCU_MAX_READERS; i++)
+    {
+        e = atomic_load(&rt->readers[i].epoch);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    while (rt->retired_head < rt->retired_tail && rt->retired[rt->retired_head].epoch < oldest)
+        pool_free(&rt->arena.pool, rt->retired[rt->retired_head++].ptr);
+    if (rt->retired_head == rt->retired_tail)
+        rt->retired_head = rt->retired_tail = 0;
+}
+
+void rcu_reclaim(struct rcu_tree *rt)
+{
+    pthread_mutex_lock(&rt->write_lock);
+    reclaim(rt);
+    pthread_mutex_unlock(&rt->write_lock);
+}
+
+// Makes room for n more retired nodes. The pending ones are moved to the
+// front of the array first, it only grows when that is not enough.
+static bool retired_reserve(struct rcu_tree *rt, size_t n)
+{
+    struct rcu_retired *grown;
+    size_t pending = rt->retired_tail - rt->retired_head, capacity;
+
+    if (rt->retired_tail + n <= rt->retired_capacity)
+        return (TRUE);
+    if (pending + n <= rt->retired_capacity / 2)
+    {
+        memmove(rt->retired, rt->retired + rt->retired_head, pending * sizeof(struct rcu_retired));
+        rt->retired_head = 0;
+        rt->retired_tail = pending;
+        return (TRUE);
+    }
+    capacity = rt->retired_capacity ? rt->retired_capacity : RCU_RECLAIM_BATCH;
+    while (capacity < 2 * (pending + n))
+        capacity *= 2;
+    grown = (struct rcu_retired *)malloc(capacity * sizeof(struct rcu_retired));
+    if (grown == NULL)
+        return (FALSE);
+    if (pending > 0)
+        memcpy(grown, rt->retired + rt->retired_head, pending * sizeof(struct rcu_retired));
+    free(rt->retired);
+    rt->retired = grown;
+    rt->retired_capacity = capacity;
+    rt->retired_head = 0;
+    rt->retired_tail = pending;
+    return (TRUE);
+}
+
+// Makes root the current version and starts a new epoch. Called with
+// write_lock held.
+static void publish(struct rcu_tree *rt, struct node *root)
+{
+    atomic_store(&rt->root, root);
+    atomic_fetch_add(&rt->epoch, 1);
+    if (rt->retired_tail - rt->retired_head >= RCU_RECLAIM_BATCH)
+        reclaim(rt);
+}
+
+int rcu_insert(struct rcu_tree *rt, avl_key_t data, avl_value_t value)
+{
+    struct node *root;
+    bool inserted = FALSE;
+
+    pthread_mutex_lock(&rt->write_lock);
+    // Only writers store the root, so the writer holding the lock sees the
+    // latest one
+    root = atomic_load_explicit(&rt->root, memory_order_relaxed);
+    if (!retired_reserve(rt, PERSIST_MAX_COPIES) ||
+        (root = persistent_insert(&rt->arena, root, data, value, &inserted)) == NULL)
+    {
+        pthread_mutex_unlock(&rt->write_lock);
+        return (-1);
+    }
+    if (!inserted)
+    {
+        pthread_mutex_unlock(&rt->write_lock);
+        return (0); // the value is already in the tree
+    }
+    publish(rt, root);
+    atomic_fetch_add_explicit(&rt->count, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&rt->write_lock);
+    return (1);
+}
+
+bool rcu_delete(struct rcu_tree *rt, avl_key_t data)
+{
+    struct node *root;
+    bool deleted = FALSE;
+
+    pthread_mutex_lock(&rt->write_lock);
+    root = atomic_load_explicit(&rt->root, memory_order_relaxed);
+    if (retired_reserve(rt, PERSIST_MAX_COPIES))
+        root = persistent_delete(&rt->arena, root, data, &deleted);
+    if (deleted)
+    {
+        publish(rt, root);
+        atomic_fetch_sub_explicit(&rt->count, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&rt->write_lock);
+    return (deleted);
+}
+
+// Taken with write_lock held, so that the root and the count belong to the
+// same version
+bool rcu_snapshot_take(struct rcu_tree *rt, struct rcu_snapshot *snap)
+{
+    snap->reader = rcu_register(rt);
+    if (snap->reader == NULL)
+        return (FALSE);
+    pthread_mutex_lock(&rt->write_lock);
+    rcu_read_lock(rt, snap->reader);
+    snap->root = rcu_root(rt);
+    snap->count = atomic_load_explicit(&rt->count, memory_order_relaxed);
+    pthread_mutex_unlock(&rt->write_lock);
+    return (TRUE);
+}
+
+void rcu_snapshot_drop(struct rcu_snapshot *snap)
+{
+    rcu_read_unlock(snap->reader);
+    rcu_unregister(snap->reader);
+    snap->reader = NULL;
+    snap->root = NULL;
+    snap->count = 0;
+}
@@ -0,0 +1,103 @@
+// Concurrent AVL tree for many readers and few writers, in the style of RCU
+// (read-copy-update).
+//
+// Readers never take a lock and never write to the tree. A writer does not
+// change a node that readers can reach: it makes a new version with the
+// persistent updates of avl_persist.h and publishes the new root with one
+// atomic store. A reader that loaded the old root goes on seeing the old
+// version.
+//
+// The nodes that were replaced are reclaimed with epoch-based reclamation.
+// Every reader has a slot where it announces the global epoch it started in.
+// Replaced nodes are tagged with the epoch they were retired in and go back
+// to the pool once no reader is still inside that epoch.
+//
+// Writers are serialized by a mutex, so this pays off when searches are far
+// more frequent than updates.
+
+#ifndef AVL_RCU_H
+#define AVL_RCU_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "avl_persist.h"
+
+#define RCU_MAX_READERS (64)
+#define RCU_CACHE_LINE (64)
+#define RCU_RECLAIM_BATCH (1024) // retired nodes collected before a reclaim pass
+
+// A reader slot. epoch is 0 while the reader is outside a read-side critical
+// section. Each slot has a cache line of its own so that readers do not slow
+// each other down.
+struct rcu_reader
+{
+    _Alignas(RCU_CACHE_LINE) atomic_uint_fast64_t epoch;
+    atomic_int in_use;
+};
+
+struct rcu_retired
+{
+    struct node *ptr;
+    uint_fast64_t epoch; // global epoch when the node was replaced
+};
+
+struct rcu_tree
+{
+    _Atomic(struct node *) root;
+    atomic_uint_fast64_t epoch; // global epoch, starts at 1
+    atomic_size_t count;        // nodes in the current version
+    pthread_mutex_t write_lock; // held by insert and delete
+    // The fields below are only used with write_lock held
+    struct avl_arena arena;
+    struct rcu_retired *retired; // replaced nodes, oldest first
+    size_t retired_head, retired_tail, retired_capacity;
+    struct rcu_reader readers[RCU_MAX_READERS];
+};
+
+void rcu_init(struct rcu_tree *rt);
+void rcu_destroy(struct rcu_tree *rt);
+
+// Each reader thread takes a slot once and gives it back when it is done.
+// rcu_register() returns NULL when all RCU_MAX_READERS slots are taken.
+struct rcu_reader *rcu_register(struct rcu_tree *rt);
+void rcu_unregister(struct rcu_reader *reader);
+
+// Between rcu_read_lock() and rcu_read_unlock() the root returned by
+// rcu_root() and every node below it stay valid and unchanged, and can be
+// passed to search(), the cursors and range_scan().
+void rcu_read_lock(struct rcu_tree *rt, struct rcu_reader *reader);
+void rcu_read_unlock(struct rcu_reader *reader);
+struct node *rcu_root(struct rcu_tree *rt);
+
+// Looks data up in its own read-side critical section and copies the value
+bool rcu_search(struct rcu_tree *rt, struct rcu_reader *reader, avl_key_t data, avl_value_t *value);
+
+// Writers. rcu_insert() adds data with value unless it is already in the tree
+// and returns 1 when it was added, 0 when it was there and -1 when the nodes
+// for the copy could not be allocated. rcu_delete() returns TRUE when data
+// was found and removed, and FALSE when it was not found or when the copies
+// could not be allocated, in which case the tree is left as it was.
+int rcu_insert(struct rcu_tree *rt, avl_key_t data, avl_value_t value);
+bool rcu_delete(struct rcu_tree *rt, avl_key_t data);
+
+// A snapshot is the version that was current when it was taken. It stays
+// readable, without rcu_read_lock(), until it is dropped, however the tree is
+// changed in the meantime. Taking or dropping one costs O(1); while it is
+// held the nodes that later updates replace are not freed, at most
+// PERSIST_MAX_COPIES per update. A snapshot holds a reader slot, so
+// rcu_snapshot_take() returns FALSE when none is free.
+struct rcu_snapshot
+{
+    struct rcu_reader *reader;
+    struct node *root;
+    size_t count; // nodes in the snapshot
+};
+
+bool rcu_snapshot_take(struct rcu_tree *rt, struct rcu_snapshot *snap);
+void rcu_snapshot_drop(struct rcu_snapshot *snap);
+
+// Frees the retired nodes that no reader can see any more. The writers call
+// it every RCU_RECLAIM_BATCH retired nodes.
+void rcu_reclaim(struct rcu_tree *rt);
+
+#endif
@@ -0,0 +1,181 @@
+// Read scalability of the RCU tree against a tree behind one read-write lock.
+//
+// Build: make avl_rcu_bench
+// Run:   ./avl_rcu_bench [max_readers] [n] [seconds] > results.csv
+//
+// The tree is loaded with n random keys (10^6 by default). Then for 1, 2, 4,
+// ... up to max_readers reader threads (the number of processors by default)
+// the readers search random keys while one writer thread keeps replacing
+// keys, a delete followed by an insert, for the given number of seconds
+// (1 by default). Each mode and reader count gives one CSV line with the
+// searches per second of all readers together, per reader, and the updates
+// per second of the writer:
+//   rcu     readers use rcu_search(), the writer rcu_insert()/rcu_delete()
+//   rwlock  an avl_tree with a pthread_rwlock_t around every operation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "avl_rcu.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_rcu_bench.c needs the default int keys"
+#endif
+
+struct rcu_tree bench_rcu;
+struct avl_tree bench_avl;
+pthread_rwlock_t bench_lock = PTHREAD_RWLOCK_INITIALIZER;
+atomic_int running;
+int use_rcu;
+size_t key_range;
+
+struct worker
+{
+    pthread_t thread;
+    uint64_t rng;
+    size_t ops;
+    size_t hits; // keys found, keeps the searches from being optimized away
+};
+
+uint64_t worker_rng(struct worker *w) // xorshift64*
+{
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return (w->rng * 2685821657736338717ULL);
+}
+
+int worker_key(struct worker *w)
+{
+    return ((int)(worker_rng(w) % key_range));
+}
+
+void *reader_main(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct rcu_reader *reader = NULL;
+    size_t ops = 0, found = 0;
+
+    if (use_rcu && (reader = rcu_register(&bench_rcu)) == NULL)
+    {
+        fprintf(stderr, "Out of reader slots\n");
+        exit(1);
+    }
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        if (use_rcu)
+            found += rcu_search(&bench_rcu, reader, worker_key(w), NULL);
+        else
+        {
+            pthread_rwlock_rdlock(&bench_lock);
+            found += (search(bench_avl.root, worker_key(w)) != NULL);
+            pthread_rwlock_unlock(&bench_lock);
+        }
+        ops++;
+    }
+    if (use_rcu)
+        rcu_unregister(reader);
+    w->ops = ops;
+    w->hits = found;
+    return (NULL);
+}
+
+void *writer_main(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    bool inserted;
+    size_t ops = 0;
+    int key;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        key = worker_key(w);
+        if (use_rcu)
+        {
+            rcu_delete(&bench_rcu, key);
+            rcu_insert(&bench_rcu, key, key);
+        }
+        else
+        {
+            pthread_rwlock_wrlock(&bench_lock);
+            delete(&bench_avl, key);
+            insert(&bench_avl, key, &inserted)->value = key;
+            pthread_rwlock_unlock(&bench_lock);
+        }
+        ops++;
+    }
+    w->ops = ops;
+    return (NULL);
+}
+
+void run(const char *mode, int nreaders, double seconds)
+{
+    struct worker *w = (struct worker *)calloc(nreaders + 1, sizeof(struct worker));
+    struct timespec pause;
+    size_t reads = 0;
+    int i;
+
+    if (w == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    fprintf(stderr, "%s with %d readers\n", mode, nreaders);
+    atomic_store(&running, 1);
+    for (i = 0; i <= nreaders; i++)
+    {
+        w[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&w[i].thread, NULL, i == 0 ? writer_main : reader_main, &w[i]);
+    }
+    pause.tv_sec = (time_t)seconds;
+    pause.tv_nsec = (long)((seconds - pause.tv_sec) * 1e9);
+    nanosleep(&pause, NULL);
+    atomic_store(&running, 0);
+    for (i = 0; i <= nreaders; i++)
+        pthread_join(w[i].thread, NULL);
+    for (i = 1; i <= nreaders; i++)
+        reads += w[i].ops;
+    printf("%s,%d,%zu,%.0f,%.0f,%.0f\n", mode, nreaders, key_range, reads / seconds,
+           reads / seconds / nreaders, w[0].ops / seconds);
+    fflush(stdout);
+    free(w);
+}
+
+int main(int argc, char *argv[])
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_readers = (argc > 1) ? atoi(argv[1]) : (ncpu > 0 ? (int)ncpu : 1);
+    double seconds = (argc > 3) ? atof(argv[3]) : 1.0;
+    struct worker loader = {0, 42, 0, 0};
+    bool inserted;
+    size_t i;
+    int nreaders, key;
+
+    key_range = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+    if (max_readers < 1 || max_readers > RCU_MAX_READERS || key_range < 1 || seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [max_readers] [n] [seconds]\n", argv[0]);
+        return (2);
+    }
+    rcu_init(&bench_rcu);
+    avl_init(&bench_avl);
+    for (i = 0; i < key_range; i++)
+    {
+        key = worker_key(&loader);
+        rcu_insert(&bench_rcu, key, key);
+        insert(&bench_avl, key, &inserted)->value = key;
+    }
+
+    printf("mode,readers,n,reads_per_s,reads_per_s_per_reader,writes_per_s\n");
+    for (nreaders = 1; nreaders <= max_readers; nreaders *= 2)
+    {
+        use_rcu = 1;
+        run("rcu", nreaders, seconds);
+        use_rcu = 0;
+        run("rwlock", nreaders, seconds);
+    }
+    rcu_destroy(&bench_rcu);
+    avl_destroy(&bench_avl);
+    return (0);
+}
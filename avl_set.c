@@ -0,0 +1,256 @@
+// Split, join and set operations, see avl_set.h.
+//
+// All three operations share set_run(): the first tree is split by the key
+// at the root of the second, the halves are combined with the sub-trees of
+// that root, and the results are joined with or without a node between them.
+// The heights travel along, as in insert_batch().
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "avl_set.h"
+
+enum set_op
+{
+    SET_UNION,
+    SET_INTERSECTION,
+    SET_DIFFERENCE
+};
+
+// One branch of the recursion. Every thread has a task of its own, so the
+// pool is not touched while the threads run: the nodes a branch drops are
+// collected in its task and only freed once all of them are joined.
+struct set_task
+{
+    enum set_op op;
+    int threads; // threads this branch may use, its own included
+    struct node *t1, *t2, *result;
+    int h1, h2, height;
+    struct node *dropped, *dropped_tail; // chained through their right pointer
+    size_t ndropped;
+    struct avl_stats stats;
+    pthread_t thread;
+};
+
+static int set_threads; // 0 for one per processor
+
+struct node *avl_join(struct node *left, struct node *mid, struct node *right)
+{
+    struct avl_stats stats;
+    int height;
+
+    memset(&stats, 0, sizeof(stats));
+    return (tree_join(left, tree_height(left), mid, right, tree_height(right), &height, &stats));
+}
+
+struct node *avl_split(struct node *root, avl_key_t data, struct node **left, struct node **right)
+{
+    struct avl_stats stats;
+    int lh, rh;
+
+    memset(&stats, 0, sizeof(stats));
+    return (tree_split(root, tree_height(root), data, left, &lh, right, &rh, &stats));
+}
+
+void avl_set_threads(int n)
+{
+    set_threads = (n > 0) ? n : 0;
+}
+
+static int thread_budget(void)
+{
+    long ncpu;
+
+    if (set_threads > 0)
+        return (set_threads);
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpu > 0 ? (int)ncpu : 1);
+}
+
+static void drop(struct set_task *task, struct node *ptr)
+{
+    ptr->right = task->dropped;
+    task->dropped = ptr;
+    if (task->dropped_tail == NULL)
+        task->dropped_tail = ptr;
+    task->ndropped++;
+}
+
+static void drop_tree(struct set_task *task, struct node *ptr)
+{
+    struct node *right;
+
+    if (ptr == NULL)
+        return;
+    right = ptr->right;
+    drop_tree(task, ptr->left);
+    drop(task, ptr);
+    drop_tree(task, right);
+}
+
+// Split and join only count rotations of the insertion kind and comparisons
+static void stats_add(struct avl_stats *stats, const struct avl_stats *more)
+{
+    stats->rot_ll += more->rot_ll;
+    stats->rot_lr += more->rot_lr;
+    stats->rot_rr += more->rot_rr;
+    stats->rot_rl += more->rot_rl;
+    stats->comparisons += more->comparisons;
+}
+
+// Takes over what a finished child task dropped and counted
+static void set_absorb(struct set_task *task, struct set_task *child)
+{
+    if (child->dropped != NULL)
+    {
+        child->dropped_tail->right = task->dropped;
+        task->dropped = child->dropped;
+        if (task->dropped_tail == NULL)
+            task->dropped_tail = child->dropped_tail;
+        task->ndropped += child->ndropped;
+    }
+    stats_add(&task->stats, &child->stats);
+}
+
+static struct node *set_run(struct set_task *task, struct node *t1, int h1, struct node *t2, int h2, int *height);
+
+static void *set_thread(void *arg)
+{
+    struct set_task *task = (struct set_task *)arg;
+
+    task->result = set_run(task, task->t1, task->h1, task->t2, task->h2, &task->height);
+    return (NULL);
+}
+
+// Combines t1, of height h1, with t2, of height h2, and returns the root of
+// the result and its height through *height. The nodes of t1 are reused; t2
+// is only read, except by the union, which reuses its nodes as well.
+static struct node *set_run(struct set_task *task, struct node *t1, int h1, struct node *t2, int h2, int *height)
+{
+    struct set_task child;
+    struct node *l1, *r1, *l2, *r2, *found, *left, *right;
+    int lh1, rh1, lh, rh, given = 0;
+    bool forked = FALSE;
+
+    if (t1 == NULL)
+    {
+        *height = (task->op == SET_UNION) ? h2 : 0;
+        return (task->op == SET_UNION ? t2 : NULL);
+    }
+    if (t2 == NULL)
+    {
+        if (task->op != SET_INTERSECTION)
+        {
+            *height = h1;
+            return (t1);
+        }
+        drop_tree(task, t1);
+        *height = 0;
+        return (NULL);
+    }
+
+    // The links of t2 are read before the union hangs it into the result
+    l2 = t2->left;
+    r2 = t2->right;
+    found = tree_split(t1, h1, t2->data, &l1, &lh1, &r1, &rh1, &task->stats);
+
+    // A left half that is big on both sides goes to a thread of its own,
+    // with half of the threads this branch may use
+    if (task->threads > 1 && lh1 >= SET_FORK_HEIGHT && LEFT_HEIGHT(t2, h2) >= SET_FORK_HEIGHT)
+    {
+        memset(&child, 0, sizeof(child));
+        child.op = task->op;
+        child.threads = given = task->threads / 2;
+        child.t1 = l1;
+        child.h1 = lh1;
+        child.t2 = l2;
+        child.h2 = LEFT_HEIGHT(t2, h2);
+        if (pthread_create(&child.thread, NULL, set_thread, &child) == 0)
+        {
+            task->threads -= given; // child.threads is the child's to change now
+            forked = TRUE;
+        }
+    }
+    if (!forked)
+        left = set_run(task, l1, lh1, l2, LEFT_HEIGHT(t2, h2), &lh);
+    right = set_run(task, r1, rh1, r2, RIGHT_HEIGHT(t2, h2), &rh);
+    if (forked)
+    {
+        pthread_join(child.thread, NULL);
+        task->threads += given;
+        left = child.result;
+        lh = child.height;
+        set_absorb(task, &child);
+    }
+
+    switch (task->op)
+    {
+    case SET_UNION:
+        if (found != NULL)
+        {
+            drop(task, t2); // the node of the first tree keeps its value
+            t2 = found;
+        }
+        return (tree_join(left, lh, t2, right, rh, height, &task->stats));
+    case SET_INTERSECTION:
+        if (found != NULL)
+            return (tree_join(left, lh, found, right, rh, height, &task->stats));
+        break;
+    case SET_DIFFERENCE:
+        if (found != NULL)
+            drop(task, found);
+        break;
+    }
+    return (tree_join2(left, lh, right, rh, height, &task->stats));
+}
+
+// Runs the operation on a and t2 and gives the dropped nodes back to the pool
+// of a, once every thread is done
+static void set_apply(struct avl_tree *a, struct node *t2, enum set_op op)
+{
+    struct set_task task;
+    struct node *ptr;
+
+    memset(&task, 0, sizeof(task));
+    task.op = op;
+    task.threads = thread_budget();
+    a->root = set_run(&task, a->root, tree_height(a->root), t2, tree_height(t2), &task.height);
+    while ((ptr = task.dropped) != NULL)
+    {
+        task.dropped = ptr->right;
+        pool_free(&a->pool, ptr);
+    }
+    a->count -= task.ndropped;
+    stats_add(&a->stats, &task.stats);
+}
+
+void avl_union(struct avl_tree *a, struct avl_tree *b)
+{
+    struct node *t2 = b->root;
+
+    if (a == b)
+        return;
+    pool_merge(&a->pool, &b->pool);
+    a->count += b->count;
+    b->root = NULL;
+    b->count = 0;
+    set_apply(a, t2, SET_UNION);
+}
+
+void avl_intersection(struct avl_tree *a, const struct avl_tree *b)
+{
+    if (a != b)
+        set_apply(a, b->root, SET_INTERSECTION);
+}
+
+void avl_difference(struct avl_tree *a, const struct avl_tree *b)
+{
+    if (a != b)
+    {
+        set_apply(a, b->root, SET_DIFFERENCE);
+        return;
+    }
+    pool_destroy(&a->pool);
+    a->root = NULL;
+    a->count = 0;
+}
@@ -0,0 +1,48 @@
+// Split, join and set operations on AVL trees.
+//
+// avl_split() and avl_join() work on bare trees and only relink nodes, so the
+// nodes stay in the pool they came from and the counts of the avl_tree they
+// belong to are up to the caller. avl_union(), avl_intersection() and
+// avl_difference() are built on them the way insert_batch() is: the first
+// tree is split by the root of the second, the two halves are combined with
+// its sub-trees and the results joined again. For trees of m <= n nodes this
+// takes O(m log(n / m + 1)) time, which no comparison-based merge can beat.
+//
+// The two halves of every step are independent, so near the top of the
+// recursion the left one is handed to a thread of its own. The number of
+// threads is set with avl_set_threads(); by default every processor is used.
+
+#ifndef AVL_SET_H
+#define AVL_SET_H
+
+#include "avl_tree.h"
+
+// Halves lower than this are not worth a thread: a tree of height 12 has
+// a few hundred nodes at the least
+#define SET_FORK_HEIGHT (12)
+
+// Joins left, mid and right into one tree and returns its root. Every key of
+// left must be smaller than the key of mid, and every key of right larger.
+// Takes O(|height(left) - height(right)| + 1) time after finding the heights.
+struct node *avl_join(struct node *left, struct node *mid, struct node *right);
+
+// Splits the tree below root into the nodes smaller than data, in *left, and
+// the nodes larger than data, in *right. Returns the node holding data, which
+// is in neither tree, or NULL. Takes O(log n) time.
+struct node *avl_split(struct node *root, avl_key_t data, struct node **left, struct node **right);
+
+// Threads the set operations may use, 0 for one per processor
+void avl_set_threads(int n);
+
+// a becomes the union of a and b, and b is left empty: its nodes, and the
+// pool they come from, are moved into a. Where both have a key, the node and
+// value of a are kept.
+void avl_union(struct avl_tree *a, struct avl_tree *b);
+
+// a keeps only the keys that are also in b, or only those that are not. b is
+// not changed. The nodes a drops go back to its pool one by one, so the
+// intersection also costs O(1) for each of those.
+void avl_intersection(struct avl_tree *a, const struct avl_tree *b);
+void avl_difference(struct avl_tree *a, const struct avl_tree *b);
+
+#endif
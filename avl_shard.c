@@ -0,0 +1,187 @@
+// Sharded AVL map, see avl_shard.h.
+
+#include <string.h>
+#include "avl_shard.h"
+
+// Maps a key to a shard. The hash is scaled into 0 .. nshards - 1 by its high
+// bits, which are the well-mixed ones of a multiplicative hash.
+static int shard_of(const struct shard_map *sm, avl_key_t data)
+{
+    uint32_t h;
+#if defined(AVL_INT_KEYS)
+    h = (uint32_t)data * 2654435761u;
+#elif defined(AVL_STRING_KEYS)
+    const unsigned char *p;
+
+    h = 2166136261u; // FNV-1a
+    for (p = (const unsigned char *)data; *p != '\0'; p++)
+        h = (h ^ *p) * 16777619u;
+#else
+    unsigned char bytes[sizeof(avl_key_t)];
+    size_t i;
+
+    memcpy(bytes, &data, sizeof(data)); // other key types are hashed as plain data
+    h = 2166136261u;
+    for (i = 0; i < sizeof(bytes); i++)
+        h = (h ^ bytes[i]) * 16777619u;
+#endif
+    return ((int)(((uint64_t)h * (uint64_t)sm->nshards) >> 32));
+}
+
+int shard_init(struct shard_map *sm, int nshards)
+{
+    void *shards;
+    int i;
+
+    sm->shards = NULL;
+    sm->nshards = 0;
+    if (nshards < 1 || posix_memalign(&shards, SHARD_CACHE_LINE, (size_t)nshards * sizeof(struct avl_shard)) != 0)
+        return (-1);
+    sm->shards = (struct avl_shard *)shards;
+    sm->nshards = nshards;
+    for (i = 0; i < nshards; i++)
+    {
+        pthread_rwlock_init(&sm->shards[i].lock, NULL);
+        avl_init(&sm->shards[i].tree);
+    }
+    return (0);
+}
+
+// Must only be called when no other thread uses the map any more
+void shard_destroy(struct shard_map *sm)
+{
+    int i;
+
+    for (i = 0; i < sm->nshards; i++)
+    {
+        avl_destroy(&sm->shards[i].tree);
+        pthread_rwlock_destroy(&sm->shards[i].lock);
+    }
+    free(sm->shards);
+    sm->shards = NULL;
+    sm->nshards = 0;
+}
+
+int shard_insert(struct shard_map *sm, avl_key_t data, avl_value_t value)
+{
+    struct avl_shard *shard = &sm->shards[shard_of(sm, data)];
+    struct node *ptr;
+    bool inserted = FALSE;
+
+    pthread_rwlock_wrlock(&shard->lock);
+    ptr = insert(&shard->tree, data, &inserted);
+    if (inserted)
+        ptr->value = value;
+    pthread_rwlock_unlock(&shard->lock);
+    if (ptr == NULL)
+        return (-1);
+    return (inserted ? 1 : 0);
+}
+
+bool shard_delete(struct shard_map *sm, avl_key_t data)
+{
+    struct avl_shard *shard = &sm->shards[shard_of(sm, data)];
+    bool deleted;
+
+    pthread_rwlock_wrlock(&shard->lock);
+    deleted = delete(&shard->tree, data);
+    pthread_rwlock_unlock(&shard->lock);
+    return (deleted);
+}
+
+bool shard_search(struct shard_map *sm, avl_key_t data, avl_value_t *value)
+{
+    struct avl_shard *shard = &sm->shards[shard_of(sm, data)];
+    struct node *ptr;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    ptr = search(shard->tree.root, data);
+    if (ptr != NULL && value != NULL)
+        *value = ptr->value;
+    pthread_rwlock_unlock(&shard->lock);
+    return (ptr != NULL);
+}
+
+size_t shard_count(struct shard_map *sm)
+{
+    size_t count = 0;
+    int i;
+
+    for (i = 0; i < sm->nshards; i++)
+    {
+        pthread_rwlock_rdlock(&sm->shards[i].lock);
+        count += sm->shards[i].tree.count;
+        pthread_rwlock_unlock(&sm->shards[i].lock);
+    }
+    return (count);
+}
+
+// The merge keeps one cursor per shard that still has keys in the range, in a
+// binary min-heap ordered by the key each cursor is on
+static bool heap_less(struct avl_cursor *cursors, int a, int b)
+{
+    return (KEY_CMP(cursor_node(&cursors[a])->data, cursor_node(&cursors[b])->data) < 0);
+}
+
+static void heap_down(struct avl_cursor *cursors, int *heap, int n, int i)
+{
+    int child, tmp;
+
+    while ((child = 2 * i + 1) < n)
+    {
+        if (child + 1 < n && heap_less(cursors, heap[child + 1], heap[child]))
+            child++;
+        if (!heap_less(cursors, heap[child], heap[i]))
+            break;
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
+
+size_t shard_range_scan(struct shard_map *sm, avl_key_t lo, avl_key_t hi,
+                        bool (*visit)(void *ctx, const struct node *ptr), void *ctx)
+{
+    struct avl_cursor *cursors;
+    const struct node *ptr;
+    size_t visited = 0;
+    int *heap, n = 0, i;
+
+    cursors = (struct avl_cursor *)malloc((size_t)sm->nshards * sizeof(struct avl_cursor));
+    heap = (int *)malloc((size_t)sm->nshards * sizeof(int));
+    if (cursors == NULL || heap == NULL)
+    {
+        free(cursors);
+        free(heap);
+        return (0);
+    }
+    // Writers only ever hold one lock, so taking them all in order is safe
+    for (i = 0; i < sm->nshards; i++)
+        pthread_rwlock_rdlock(&sm->shards[i].lock);
+    for (i = 0; i < sm->nshards; i++)
+    {
+        ptr = cursor_lower_bound(sm->shards[i].tree.root, lo, &cursors[i]);
+        if (ptr != NULL && KEY_CMP(ptr->data, hi) < 0)
+            heap[n++] = i;
+    }
+    for (i = n / 2 - 1; i >= 0; i--)
+        heap_down(cursors, heap, n, i);
+
+    while (n > 0)
+    {
+        visited++;
+        if (!visit(ctx, cursor_node(&cursors[heap[0]])))
+            break;
+        ptr = cursor_next(&cursors[heap[0]]);
+        if (ptr == NULL || KEY_CMP(ptr->data, hi) >= 0)
+            heap[0] = heap[--n]; // this shard has no more keys in the range
+        heap_down(cursors, heap, n, 0);
+    }
+
+    for (i = sm->nshards - 1; i >= 0; i--)
+        pthread_rwlock_unlock(&sm->shards[i].lock);
+    free(cursors);
+    free(heap);
+    return (visited);
+}
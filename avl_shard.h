@@ -0,0 +1,55 @@
+// Sharded AVL map for many threads that all update.
+//
+// The keys are spread over nshards independent trees by a hash of the key.
+// Every shard is an ordinary avl_tree behind a read-write lock of its own, so
+// operations on different shards run in parallel and those on one shard are
+// no slower than on a tree with a single lock. Each shard starts on a cache
+// line of its own, so that the locks of neighbouring shards do not share one.
+//
+// A hash spreads any key distribution evenly, but takes the order away: a
+// range scan walks every shard and merges them back into key order.
+
+#ifndef AVL_SHARD_H
+#define AVL_SHARD_H
+
+#include <pthread.h>
+#include "avl_tree.h"
+
+#define SHARD_CACHE_LINE (64)
+
+struct avl_shard
+{
+    _Alignas(SHARD_CACHE_LINE) pthread_rwlock_t lock;
+    struct avl_tree tree;
+};
+
+struct shard_map
+{
+    struct avl_shard *shards;
+    int nshards;
+};
+
+// Returns 0, or -1 when nshards is below 1 or out of memory
+int shard_init(struct shard_map *sm, int nshards);
+void shard_destroy(struct shard_map *sm);
+
+// shard_insert() adds data with value unless it is already in the map and
+// returns 1 when it was added, 0 when it was there and -1 when out of memory.
+// shard_search() copies the value of data when value is not NULL.
+int shard_insert(struct shard_map *sm, avl_key_t data, avl_value_t value);
+bool shard_delete(struct shard_map *sm, avl_key_t data);
+bool shard_search(struct shard_map *sm, avl_key_t data, avl_value_t *value);
+
+// Nodes in all shards together. The shards are counted one after another, so
+// with concurrent updates the total need not have held at any one time.
+size_t shard_count(struct shard_map *sm);
+
+// Calls visit for every node whose key lies in [lo, hi), in increasing order,
+// as range_scan() does, and returns the number of nodes visited. Every shard is
+// read-locked for the whole scan, which makes it a consistent view of the map
+// but holds up the writers; visit must not change the map. Returns 0 when
+// out of memory.
+size_t shard_range_scan(struct shard_map *sm, avl_key_t lo, avl_key_t hi,
+                        bool (*visit)(void *ctx, const struct node *ptr), void *ctx);
+
+#endif
@@ -0,0 +1,159 @@
+// Scaling of the sharded map against one tree behind one read-write lock.
+//
+// Build: make avl_shard_bench
+// Run:   ./avl_shard_bench [max_threads] [n] [seconds] [shards] > results.csv
+//
+// The map is loaded with n/2 of the keys 0 .. n-1 (n is 10^6 by default).
+// Then for 1, 2, 4, ... up to max_threads threads (64 by default) every
+// thread runs a mix of operations on random keys for the given number of
+// seconds (1 by default): 80% searches, 10% inserts and 10% deletes, so the
+// size stays about the same. Each mode and thread count gives one CSV line
+// with the operations per second of all threads together and per thread:
+//   sharded  a shard_map with the given number of shards (64 by default)
+//   global   an avl_tree with a pthread_rwlock_t around every operation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "avl_shard.h"
+
+#ifndef AVL_INT_KEYS
+#error "avl_shard_bench.c needs the default int keys"
+#endif
+
+struct shard_map bench_map;
+struct avl_tree bench_avl;
+pthread_rwlock_t bench_lock = PTHREAD_RWLOCK_INITIALIZER;
+atomic_int running;
+int use_shards;
+size_t key_range;
+
+struct worker
+{
+    pthread_t thread;
+    uint64_t rng;
+    size_t ops;
+    size_t hits; // keys found, keeps the searches from being optimized away
+};
+
+uint64_t worker_rng(struct worker *w) // xorshift64*
+{
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return (w->rng * 2685821657736338717ULL);
+}
+
+void *worker_main(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    size_t ops = 0, found = 0;
+    bool inserted;
+    uint64_t r;
+    int key, op;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        r = worker_rng(w);
+        key = (int)((r >> 8) % key_range);
+        op = (int)(r & 0xff) % 10; // 0 inserts, 1 deletes, the rest search
+        if (use_shards)
+        {
+            if (op == 0)
+                shard_insert(&bench_map, key, key);
+            else if (op == 1)
+                shard_delete(&bench_map, key);
+            else
+                found += shard_search(&bench_map, key, NULL);
+        }
+        else if (op <= 1)
+        {
+            pthread_rwlock_wrlock(&bench_lock);
+            if (op == 0)
+                insert(&bench_avl, key, &inserted)->value = key;
+            else
+                delete(&bench_avl, key);
+            pthread_rwlock_unlock(&bench_lock);
+        }
+        else
+        {
+            pthread_rwlock_rdlock(&bench_lock);
+            found += (search(bench_avl.root, key) != NULL);
+            pthread_rwlock_unlock(&bench_lock);
+        }
+        ops++;
+    }
+    w->ops = ops;
+    w->hits = found;
+    return (NULL);
+}
+
+void run(const char *mode, int nthreads, int nshards, double seconds)
+{
+    struct worker *w = (struct worker *)calloc(nthreads, sizeof(struct worker));
+    struct timespec pause;
+    size_t ops = 0;
+    int i;
+
+    if (w == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    fprintf(stderr, "%s with %d threads\n", mode, nthreads);
+    atomic_store(&running, 1);
+    for (i = 0; i < nthreads; i++)
+    {
+        w[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&w[i].thread, NULL, worker_main, &w[i]);
+    }
+    pause.tv_sec = (time_t)seconds;
+    pause.tv_nsec = (long)((seconds - pause.tv_sec) * 1e9);
+    nanosleep(&pause, NULL);
+    atomic_store(&running, 0);
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(w[i].thread, NULL);
+        ops += w[i].ops;
+    }
+    printf("%s,%d,%d,%zu,%.0f,%.0f\n", mode, nthreads, use_shards ? nshards : 1, key_range, ops / seconds,
+           ops / seconds / nthreads);
+    fflush(stdout);
+    free(w);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = (argc > 1) ? atoi(argv[1]) : 64;
+    double seconds = (argc > 3) ? atof(argv[3]) : 1.0;
+    int nshards = (argc > 4) ? atoi(argv[4]) : 64;
+    bool inserted;
+    size_t i;
+    int nthreads;
+
+    key_range = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+    if (max_threads < 1 || key_range < 2 || seconds <= 0 || shard_init(&bench_map, nshards) != 0)
+    {
+        fprintf(stderr, "usage: %s [max_threads] [n] [seconds] [shards]\n", argv[0]);
+        return (2);
+    }
+    avl_init(&bench_avl);
+    for (i = 0; i < key_range; i += 2)
+    {
+        shard_insert(&bench_map, (int)i, (int)i);
+        insert(&bench_avl, (int)i, &inserted)->value = (int)i;
+    }
+
+    printf("mode,threads,shards,n,ops_per_s,ops_per_s_per_thread\n");
+    for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+    {
+        use_shards = 1;
+        run("sharded", nthreads, nshards, seconds);
+        use_shards = 0;
+        run("global", nthreads, nshards, seconds);
+    }
+    shard_destroy(&bench_map);
+    avl_destroy(&bench_avl);
+    return (0);
+}
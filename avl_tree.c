@@ -0,0 +1,2386 @@
+// AVL tree library, see avl_tree.h.
+// The insertion code is from the texbook Data Structures Using C, 2nd edition, by Reema Thareja, Oxford University Press, 2014.
+// Data Structures, 7.5 credits, Spring 2022
+
+#include "avl_tree.h"
+#ifdef AVL_INSTRUMENT
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+#define max(x,y) (((x) >= (y)) ? (x) : (y))
+
+// Build with -DAVL_TRACE to have every rotation printed as it happens. In a
+// normal build TRACE() expands to nothing and rotations are only counted.
+#ifdef AVL_TRACE
+#define TRACE(msg) printf("%s\n", (msg))
+#else
+#define TRACE(msg) ((void)0)
+#endif
+
+// Without AVL_ORDER_STATS the node has no size field and UPDATE_SIZE() does nothing
+#ifdef AVL_ORDER_STATS
+#define NODE_SIZE(p) ((p) == NULL ? 0 : (p)->size)
+#define UPDATE_SIZE(p) ((p)->size = NODE_SIZE((p)->left) + NODE_SIZE((p)->right) + 1)
+#else
+#define UPDATE_SIZE(p) ((void)0)
+#endif
+
+#define POOL_FIRST_CHUNK (256)   // nodes in the first chunk
+#define POOL_MAX_CHUNK (65536)   // chunks double in size up to this many nodes
+
+#define CNODE_FIRST_CAPACITY (64)
+
+void pool_init(struct node_pool *pool)
+{
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+}
+
+// Returns NULL when the system is out of memory
+struct node *pool_alloc(struct node_pool *pool)
+{
+    struct node *ptr;
+    struct pool_chunk *chunk;
+    size_t capacity;
+
+    if (pool->free_list != NULL) // reuse a node released by delete()
+    {
+        ptr = pool->free_list;
+        pool->free_list = ptr->right;
+        return (ptr);
+    }
+    chunk = pool->chunks;
+    if (chunk == NULL || chunk->used == chunk->capacity) // start a new chunk
+    {
+        capacity = (chunk == NULL) ? POOL_FIRST_CHUNK : chunk->capacity * 2;
+        if (capacity > POOL_MAX_CHUNK)
+            capacity = POOL_MAX_CHUNK;
+        chunk = (struct pool_chunk *)malloc(sizeof(struct pool_chunk) + capacity * sizeof(struct node));
+        if (chunk == NULL)
+            return (NULL);
+        chunk->next = pool->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        pool->chunks = chunk;
+    }
+    return (&chunk->nodes[chunk->used++]);
+}
+
+void pool_free(struct node_pool *pool, struct node *ptr)
+{
+    ptr->right = pool->free_list;
+    pool->free_list = ptr;
+}
+
+// Returns n nodes that lie next to each other in memory, or NULL when the
+// system is out of memory. They get a chunk of their own, which is linked in
+// behind the newest chunk so that its unused nodes are not lost.
+struct node *pool_alloc_block(struct node_pool *pool, size_t n)
+{
+    struct pool_chunk *chunk;
+
+    chunk = (struct pool_chunk *)malloc(sizeof(struct pool_chunk) + n * sizeof(struct node));
+    if (chunk == NULL)
+        return (NULL);
+    chunk->used = n;
+    chunk->capacity = n;
+    if (pool->chunks == NULL)
+    {
+        chunk->next = NULL;
+        pool->chunks = chunk;
+    }
+    else
+    {
+        chunk->next = pool->chunks->next;
+        pool->chunks->next = chunk;
+    }
+    return (chunk->nodes);
+}
+
+// Moves every node of from into pool, which owns them from then on, and
+// leaves from empty. The unused nodes of the newest chunk of from and its
+// free list go onto the free list of pool, the other chunks are linked in
+// behind the newest chunk of pool.
+void pool_merge(struct node_pool *pool, struct node_pool *from)
+{
+    struct pool_chunk *chunk, *last;
+    struct node *ptr;
+
+    chunk = from->chunks;
+    if (chunk == NULL)
+        return;
+    while (chunk->used < chunk->capacity)
+        pool_free(pool, &chunk->nodes[chunk->used++]);
+    while ((ptr = from->free_list) != NULL)
+    {
+        from->free_list = ptr->right;
+        pool_free(pool, ptr);
+    }
+    for (last = chunk; last->next != NULL; last = last->next)
+        ;
+    if (pool->chunks == NULL)
+        pool->chunks = chunk;
+    else
+    {
+        last->next = pool->chunks->next;
+        pool->chunks->next = chunk;
+    }
+    pool_init(from);
+}
+
+// Releases every node of the pool at once, the tree is not walked
+void pool_destroy(struct node_pool *pool)
+{
+    struct pool_chunk *chunk, *next;
+    for (chunk = pool->chunks; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+    pool_init(pool);
+}
+
+void avl_stats_reset(struct avl_tree *avl)
+{
+    struct avl_stats zero = {0};
+    avl->stats = zero;
+}
+
+void avl_init(struct avl_tree *avl)
+{
+    avl->root = NULL;
+    avl->count = 0;
+    pool_init(&avl->pool);
+    avl_stats_reset(avl);
+#ifdef AVL_INSTRUMENT
+    avl_instrument_reset(avl);
+#endif
+}
+
+void avl_stats_dump(const struct avl_tree *avl, FILE *out)
+{
+    const struct avl_stats *st = &avl->stats;
+    fprintf(out, "Rotations on insert : LL %zu, LR %zu, RR %zu, RL %zu\n",
+            st->rot_ll, st->rot_lr, st->rot_rr, st->rot_rl);
+    fprintf(out, "Rotations on delete : R0 %zu, R1 %zu, R-1 %zu, L0 %zu, L1 %zu, L-1 %zu\n",
+            st->rot_r0, st->rot_r1, st->rot_rm1, st->rot_l0, st->rot_l1, st->rot_lm1);
+    fprintf(out, "Node allocations    : %zu\n", st->allocations);
+    fprintf(out, "Comparisons         : %zu\n", st->comparisons);
+    fprintf(out, "Maximum depth       : %d\n", st->max_depth);
+}
+
+#ifdef AVL_INSTRUMENT
+// The time stamp counter costs a few ns to read where clock_gettime() costs
+// 20 or more; its ticks are turned into ns only when the histograms are dumped
+static inline uint64_t instrument_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (__rdtsc());
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+#endif
+}
+
+static double instrument_ticks_per_ns(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec t0, t1, pause = {0, 20000000}; // 20 ms
+    uint64_t c0, c1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = __rdtsc();
+    nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = __rdtsc();
+    return ((double)(c1 - c0) / ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)));
+#else
+    return (1.0);
+#endif
+}
+
+// Values below 16 have a bucket each. Above, the top bit of the value picks a
+// group of 16 buckets and the next 4 bits the bucket in it.
+static inline int hist_bucket(uint64_t v)
+{
+    int e;
+
+    if (v < (1u << HIST_SUB_BITS))
+        return ((int)v);
+    e = 63 - __builtin_clzll(v);
+    return (((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((v >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1)));
+}
+
+// Smallest value that falls into bucket i
+static uint64_t hist_lowest(int i)
+{
+    int group = i >> HIST_SUB_BITS;
+
+    if (group == 0)
+        return ((uint64_t)i);
+    return ((uint64_t)((1u << HIST_SUB_BITS) + (i & ((1u << HIST_SUB_BITS) - 1))) << (group - 1));
+}
+
+static inline void hist_record(struct avl_histogram *h, uint64_t v)
+{
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+// Value at quantile q, as the highest value of its bucket but never above the
+// largest value recorded
+static uint64_t hist_quantile(const struct avl_histogram *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * h->count + 0.5), seen = 0, high;
+    int i;
+
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            high = (i + 1 < HIST_BUCKETS) ? hist_lowest(i + 1) - 1 : UINT64_MAX;
+            return (high < h->max ? high : h->max);
+        }
+    }
+    return (h->max);
+}
+
+// Sum of the rotation counters, so that an update's rotations are the
+// difference between two sums
+static inline size_t stats_rotations(const struct avl_stats *st)
+{
+    return (st->rot_ll + st->rot_lr + st->rot_rr + st->rot_rl + st->rot_r0 + st->rot_r1 + st->rot_rm1 +
+            st->rot_l0 + st->rot_l1 + st->rot_lm1);
+}
+
+static inline void instrument_record(struct avl_instrument *in, enum avl_op op, uint64_t start, int depth,
+                                     size_t rotations)
+{
+    hist_record(&in->latency[op], instrument_clock() - start);
+    in->depth[op][depth <= AVL_MAX_HEIGHT ? depth : AVL_MAX_HEIGHT]++;
+    if (op != AVL_OP_SEARCH)
+        in->rotations[op][rotations <= AVL_MAX_HEIGHT ? rotations : AVL_MAX_HEIGHT]++;
+}
+
+void avl_instrument_reset(struct avl_tree *avl)
+{
+    memset(&avl->instrument, 0, sizeof(avl->instrument));
+}
+
+static void dump_counts(FILE *out, const uint64_t *counts, bool json)
+{
+    int i, last = 0;
+
+    for (i = 0; i <= AVL_MAX_HEIGHT; i++)
+        if (counts[i] != 0)
+            last = i;
+    for (i = 0; i <= last; i++)
+    {
+        if (json)
+            fprintf(out, "%s%" PRIu64, i > 0 ? "," : "", counts[i]);
+        else if (counts[i] != 0)
+            fprintf(out, " %d:%" PRIu64, i, counts[i]);
+    }
+}
+
+static void dump_histogram(FILE *out, const char *name, const struct avl_histogram *h, double ticks_per_ns,
+                           bool json)
+{
+    double p50 = hist_quantile(h, 0.5) / ticks_per_ns, p99 = hist_quantile(h, 0.99) / ticks_per_ns;
+    double p999 = hist_quantile(h, 0.999) / ticks_per_ns, max = h->max / ticks_per_ns;
+
+    if (json)
+        fprintf(out, "\"%s\":{\"count\":%" PRIu64 ",\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f,\"max_ns\":%.1f",
+                name, h->count, p50, p99, p999, max);
+    else
+        fprintf(out, "%-11s: %" PRIu64 " ops, p50 %.1f ns, p99 %.1f ns, p999 %.1f ns, max %.1f ns\n", name, h->count,
+                p50, p99, p999, max);
+}
+
+void avl_instrument_dump(const struct avl_tree *avl, FILE *out, bool json)
+{
+    static const char *names[AVL_NOPS] = {"insert", "delete", "search"};
+    const struct avl_instrument *in = &avl->instrument;
+    double ticks_per_ns = instrument_ticks_per_ns();
+    int op;
+
+    if (json)
+        fputc('{', out);
+    for (op = 0; op < AVL_NOPS; op++)
+    {
+        if (json && op > 0)
+            fputc(',', out);
+        dump_histogram(out, names[op], &in->latency[op], ticks_per_ns, json);
+        fprintf(out, json ? ",\"depth\":[" : "  depth    :");
+        dump_counts(out, in->depth[op], json);
+        if (op != AVL_OP_SEARCH)
+        {
+            fprintf(out, json ? "],\"rotations\":[" : "\n  rotations:");
+            dump_counts(out, in->rotations[op], json);
+        }
+        fprintf(out, json ? "]}" : "\n");
+    }
+    if (json)
+        fputc(',', out);
+    dump_histogram(out, "pool_grow", &in->pool_grow, ticks_per_ns, json);
+    if (json)
+        fprintf(out, "}}\n");
+}
+#endif
+
+void avl_destroy(struct avl_tree *avl)
+{
+    pool_destroy(&avl->pool);
+    avl->root = NULL;
+    avl->count = 0;
+}
+
+// Value given to nodes until the caller stores one
+static const avl_value_t zero_value;
+
+struct node *search(struct node *ptr, avl_key_t data)
+{
+    int cmp;
+    while (ptr != NULL && (cmp = KEY_CMP(data, ptr->data)) != 0)
+        ptr = (cmp < 0) ? ptr->left : ptr->right;
+    return (ptr);
+}
+
+// search() on the tree of a handle. Without AVL_INSTRUMENT it is the same;
+// with it the lookup is timed and its depth counted, so unlike search() it
+// must not run in parallel with other lookups on the same tree.
+struct node *avl_search(struct avl_tree *avl, avl_key_t data)
+{
+#ifdef AVL_INSTRUMENT
+    uint64_t start = instrument_clock();
+    struct node *ptr = avl->root;
+    int depth = 0, cmp;
+
+    while (ptr != NULL && (cmp = KEY_CMP(data, ptr->data)) != 0)
+    {
+        ptr = (cmp < 0) ? ptr->left : ptr->right;
+        depth++;
+    }
+    instrument_record(&avl->instrument, AVL_OP_SEARCH, start, depth + (ptr != NULL), 0);
+    return (ptr);
+#else
+    return (search(avl->root, data));
+#endif
+}
+
+// Looks up keys[0] .. keys[n - 1] and sets out[i] to what search() returns
+// for keys[i]. SEARCH_BATCH descents are kept in flight: every round moves
+// each of them down one level and prefetches the child it goes to, so the
+// cache misses of different keys overlap instead of following one another.
+// A descent that is done hands its slot to the next key. Returns the number
+// of keys found.
+size_t search_batch(struct node *root, const avl_key_t *keys, size_t n, struct node **out)
+{
+    struct node *ptr[SEARCH_BATCH], *cur;
+    size_t idx[SEARCH_BATCH];
+    size_t next = 0, hits = 0;
+    int active = 0, j, cmp;
+
+    for (; active < SEARCH_BATCH && next < n; active++)
+    {
+        ptr[active] = root;
+        idx[active] = next++;
+    }
+    while (active > 0)
+    {
+        for (j = 0; j < active;)
+        {
+            cur = ptr[j];
+            if (cur != NULL && (cmp = KEY_CMP(keys[idx[j]], cur->data)) != 0)
+            {
+                ptr[j] = (cmp < 0) ? cur->left : cur->right;
+                if (ptr[j] != NULL)
+                    __builtin_prefetch(ptr[j]);
+                j++;
+                continue;
+            }
+            out[idx[j]] = cur;
+            hits += (cur != NULL);
+            if (next < n)
+            {
+                ptr[j] = root;
+                idx[j++] = next++;
+            }
+            else // the last slot moves into this one and is looked at next
+            {
+                active--;
+                ptr[j] = ptr[active];
+                idx[j] = idx[active];
+            }
+        }
+    }
+    return (hits);
+}
+
+#ifdef AVL_RELAXED
+// Relaxed balancing lets the balance factors range over -AVL_MAX_BALANCE ..
+// AVL_MAX_BALANCE, so the fixed cases of the slides do not cover every
+// rotation. These rotations update the balance factors by the general rule
+// and return by how many levels the height of the sub-tree has changed.
+
+// Height of a sub-tree with balance factor b above its right (left) sub-tree
+#define ABOVE_RIGHT(b) (((b) > 0 ? (b) : 0) + 1)
+#define ABOVE_LEFT(b) (((b) < 0 ? -(b) : 0) + 1)
+
+static int rotate_right(struct node **link)
+{
+    struct node *tree = *link, *aptr = tree->left;
+    int old = ABOVE_RIGHT(tree->balance);
+
+    TRACE("Right Rotation");
+    tree->left = aptr->right;
+    aptr->right = tree;
+    tree->balance -= 1 + (aptr->balance > 0 ? aptr->balance : 0);
+    aptr->balance -= 1 - (tree->balance < 0 ? tree->balance : 0);
+    UPDATE_SIZE(tree);
+    UPDATE_SIZE(aptr);
+    *link = aptr;
+    return (ABOVE_RIGHT(tree->balance) + ABOVE_RIGHT(aptr->balance) - old);
+}
+
+static int rotate_left(struct node **link)
+{
+    struct node *tree = *link, *aptr = tree->right;
+    int old = ABOVE_LEFT(tree->balance);
+
+    TRACE("Left Rotation");
+    tree->right = aptr->left;
+    aptr->left = tree;
+    tree->balance += 1 - (aptr->balance < 0 ? aptr->balance : 0);
+    aptr->balance += 1 + (tree->balance > 0 ? tree->balance : 0);
+    UPDATE_SIZE(tree);
+    UPDATE_SIZE(aptr);
+    *link = aptr;
+    return (ABOVE_LEFT(tree->balance) + ABOVE_LEFT(aptr->balance) - old);
+}
+
+// Rotates the node at *link, whose balance factor has just gone one past the
+// bound, back into balance: with one rotation when its higher child leans
+// the same way or not at all, and with two when it leans the other way.
+// Returns the change of the height. The rotations are counted under the
+// names insert() or, with deleting, delete() uses for them; unshare is as
+// in delete_rebalance().
+static int relaxed_rotate(struct node **link, bool deleting, struct avl_stats *stats,
+                          struct node *(*unshare)(void *ctx, struct node *ptr), void *ctx)
+{
+    struct node *tree = *link, *aptr;
+    int change = 0, old;
+
+    if (tree->balance > 0) // left heavy
+    {
+        aptr = tree->left;
+        if (unshare != NULL)
+            aptr = tree->left = unshare(ctx, aptr);
+        if (!deleting)
+            *(aptr->balance >= 0 ? &stats->rot_ll : &stats->rot_lr) += 1;
+        else
+            *(aptr->balance > 0 ? &stats->rot_r1 : aptr->balance == 0 ? &stats->rot_r0 : &stats->rot_rm1) += 1;
+        if (aptr->balance < 0)
+        {
+            if (unshare != NULL)
+                aptr->right = unshare(ctx, aptr->right);
+            old = tree->balance;
+            tree->balance += rotate_left(&tree->left);
+            change = ABOVE_RIGHT(tree->balance) - ABOVE_RIGHT(old);
+        }
+        return (change + rotate_right(link));
+    }
+    aptr = tree->right; // right heavy
+    if (unshare != NULL)
+        aptr = tree->right = unshare(ctx, aptr);
+    if (!deleting)
+        *(aptr->balance <= 0 ? &stats->rot_rr : &stats->rot_rl) += 1;
+    else
+        *(aptr->balance < 0 ? &stats->rot_lm1 : aptr->balance == 0 ? &stats->rot_l0 : &stats->rot_l1) += 1;
+    if (aptr->balance > 0)
+    {
+        if (unshare != NULL)
+            aptr->left = unshare(ctx, aptr->left);
+        old = tree->balance;
+        tree->balance -= rotate_right(&tree->right);
+        change = ABOVE_LEFT(tree->balance) - ABOVE_LEFT(old);
+    }
+    return (change + rotate_left(link));
+}
+
+// Grows the sub-tree on the given side of the node at *link by one level and
+// rebalances the node when needed. Returns whether the node's sub-tree has
+// grown too: it has when the side that grew was not the lower one.
+static int relaxed_grow(struct node **link, bool left, struct avl_stats *stats)
+{
+    struct node *tree = *link;
+    int change = left ? (tree->balance++ >= 0) : (tree->balance-- <= 0);
+
+    if (tree->balance > AVL_MAX_BALANCE || tree->balance < -AVL_MAX_BALANCE)
+        change += relaxed_rotate(link, FALSE, stats, NULL, NULL);
+    return (change);
+}
+#endif
+
+// Restores the AVL balance after a leaf was linked in at path[depth]. path[i]
+// is the link that holds the node at depth i, and every node on the path has
+// to be writable: the rotations only move nodes that are on it.
+#ifdef AVL_RELAXED
+void insert_rebalance(struct node **path[], int depth, struct avl_stats *stats)
+{
+    // Walk up until a node absorbs the growth. A rotation always does.
+    while (depth-- > 0)
+        if (!relaxed_grow(path[depth], path[depth + 1] == &(*path[depth])->left, stats))
+            break;
+}
+#else
+void insert_rebalance(struct node **path[], int depth, struct avl_stats *stats)
+{
+    struct node **link, *tree, *aptr, *bptr;
+
+    // The sub-tree below each node on the path has grown by one level; walk
+    // up only until a node absorbs the growth or a rebalancing rotation is done.
+    while (depth-- > 0)
+    {
+        link = path[depth];
+        tree = *link;
+        if (path[depth + 1] == &tree->left) // the left sub-tree has grown
+        {
+            if (tree->balance == -1) /* Right heavy */
+            {
+                // the node was right heavy and after insertion has become balanced.
+                tree->balance = 0;
+                break;
+            }
+            if (tree->balance == 0) /* Balanced */
+            {
+                // the node was balanced and after insertion has become left heavy.
+                tree->balance = 1;
+                continue;
+            }
+            // the node was left heavy and after insertion has become an unbalanced sub-tree.
+            // Rebalancing rotation is needed - determine the type of rotation
+            aptr = tree->left; // "tree" is A and "aptr" is B (see slides 46 and 48)
+            if (aptr->balance == 1)
+            {
+                // LL rotation: the new node is inserted in the left sub-tree of
+                // the left sub-tree of the critical node
+                stats->rot_ll++;
+                TRACE("Left to Left Rotation");
+                tree->left = aptr->right; // T2 is made left sub-tree of A (see slide 46)
+                aptr->right = tree;       // A is made right sub-tree of B (see slide 46)
+                tree->balance = 0;
+                aptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                *link = aptr; // B is moved up to the A-place (see slide 46)
+            }
+            else
+            {
+                // LR rotation: the new node is inserted in the right sub-tree of
+                // the left sub-tree of the critical node
+                stats->rot_lr++;
+                TRACE("Left to Right Rotation");
+                bptr = aptr->right;       // "bptr" is C (see slide 48)
+                aptr->right = bptr->left; // T2 is made right sub-tree of B (see slide 48)
+                bptr->left = aptr;        // B is made left sub-tree of C (see slide 48)
+                tree->left = bptr->right; // T3 is made left sub-tree of A (see slide 48)
+                bptr->right = tree;       // A is made right sub-tree of C (see slide 48)
+                tree->balance = (bptr->balance == 1) ? -1 : 0;
+                aptr->balance = (bptr->balance == -1) ? 1 : 0;
+                bptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                UPDATE_SIZE(bptr);
+                *link = bptr; // C moved up to the A-place (see slide 48)
+            }
+        }
+        else // the right sub-tree has grown
+        {
+            if (tree->balance == 1) /* Left heavy */
+            {
+                // the node was left heavy and after insertion has become balanced.
+                tree->balance = 0;
+                break;
+            }
+            if (tree->balance == 0) /* Balanced */
+            {
+                // the node was balanced and after insertion has become right heavy.
+                tree->balance = -1;
+                continue;
+            }
+            // the node was right heavy and after insertion has become an unbalanced sub-tree.
+            // Rebalancing rotation is needed - determine the type of rotation
+            aptr = tree->right; // "tree" is A and "aptr" is B (see slides 47 and 49)
+            if (aptr->balance == -1)
+            {
+                // RR rotation: the new node is inserted in the right sub-tree of
+                // the right sub-tree of the critical node
+                stats->rot_rr++;
+                TRACE("Right to Right Rotation");
+                tree->right = aptr->left; // T2 is made right sub-tree of A (see slide 47)
+                aptr->left = tree;        // A is made left sub-tree of B (see slide 47)
+                tree->balance = 0;
+                aptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                *link = aptr; // B is moved up to A-place (see slide 47)
+            }
+            else
+            {
+                // RL rotation: the new node is inserted in the left sub-tree of
+                // the right sub-tree of the critical node
+                stats->rot_rl++;
+                TRACE("Right to Left Rotation");
+                bptr = aptr->left;        // "bptr" is C (see slide 49)
+                aptr->left = bptr->right; // T3 is made left sub-tree of B (see slide 49)
+                bptr->right = aptr;       // B is made right sub-tree of C (see slide 49)
+                tree->right = bptr->left; // T2 is made right sub-tree of A (see slide 49)
+                bptr->left = tree;        // A is made left sub-tree of C (see slide 49)
+                tree->balance = (bptr->balance == -1) ? 1 : 0;
+                aptr->balance = (bptr->balance == 1) ? -1 : 0;
+                bptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                UPDATE_SIZE(bptr);
+                *link = bptr; // C is moved up to A-place (see slide 49)
+            }
+        }
+        break; // re-balancing is done, the sub-tree has its old height again
+    }
+}
+#endif
+
+// Inserts data with a single descent from the root, so callers do not have to
+// search() first. Returns the node holding data; *inserted is TRUE when that
+// node was created by this call and FALSE when data was a duplicate. NULL is
+// returned when the node could not be allocated. A new node has a zero value,
+// the caller stores the real one in the returned node.
+struct node *insert(struct avl_tree *avl, avl_key_t data, bool *inserted)
+{
+    // path[i] is the link (the root pointer or a child pointer of the parent)
+    // that holds the node at depth i. Rotations rewrite these links directly.
+    struct node **path[AVL_MAX_HEIGHT + 1];
+    struct node **link = &avl->root;
+    struct node *ptr;
+    int depth = 0, cmp;
+#ifdef AVL_INSTRUMENT
+    uint64_t start = instrument_clock();
+    size_t rotations = stats_rotations(&avl->stats);
+    struct pool_chunk *chunks = avl->pool.chunks;
+#endif
+
+    *inserted = FALSE;
+    // A new node is inserted as a leaf.
+    // First find where to add it by following the BST order
+    while ((ptr = *link) != NULL)
+    {
+        path[depth++] = link;
+        cmp = KEY_CMP(data, ptr->data);
+        if (cmp < 0)
+            link = &ptr->left;
+        else if (cmp > 0)
+            link = &ptr->right;
+        else
+            break;
+    }
+    avl->stats.comparisons += depth;
+    if (depth > avl->stats.max_depth)
+        avl->stats.max_depth = depth;
+    if (ptr != NULL)
+    {
+#ifdef AVL_INSTRUMENT
+        instrument_record(&avl->instrument, AVL_OP_INSERT, start, depth, 0);
+#endif
+        return (ptr); // the value is already in the tree
+    }
+    ptr = pool_alloc(&avl->pool);
+    if (ptr == NULL)
+        return (NULL);
+    avl->stats.allocations++;
+    ptr->data = data;
+    ptr->value = zero_value;
+    ptr->left = NULL;
+    ptr->right = NULL;
+    ptr->balance = 0;
+    *link = ptr;
+    avl->count++;
+    *inserted = TRUE;
+    path[depth] = link;
+#ifdef AVL_ORDER_STATS
+    // every sub-tree on the path has gained a node
+    ptr->size = 1;
+    for (int i = 0; i < depth; i++)
+        (*path[i])->size++;
+#endif
+
+    // Then check the balance factors on the way back up
+    insert_rebalance(path, depth, &avl->stats);
+#ifdef AVL_INSTRUMENT
+    instrument_record(&avl->instrument, AVL_OP_INSERT, start, depth, stats_rotations(&avl->stats) - rotations);
+    if (avl->pool.chunks != chunks)
+        hist_record(&avl->instrument.pool_grow, instrument_clock() - start);
+#endif
+    return (ptr);
+}
+
+// Current node of the cursor, or NULL when it is past either end
+const struct node *cursor_node(const struct avl_cursor *cur)
+{
+    return (cur->depth > 0 ? cur->path[cur->depth - 1] : NULL);
+}
+
+// Extends the path from ptr down its left-most (or right-most) branch
+static const struct node *cursor_descend(struct avl_cursor *cur, const struct node *ptr, bool leftmost)
+{
+    while (ptr != NULL)
+    {
+        cur->path[cur->depth++] = ptr;
+        ptr = leftmost ? ptr->left : ptr->right;
+    }
+    return (cursor_node(cur));
+}
+
+// Moves the cursor to the smallest key in the tree below root
+const struct node *cursor_first(const struct node *root, struct avl_cursor *cur)
+{
+    cur->depth = 0;
+    return (cursor_descend(cur, root, TRUE));
+}
+
+// Moves the cursor to the largest key in the tree below root
+const struct node *cursor_last(const struct node *root, struct avl_cursor *cur)
+{
+    cur->depth = 0;
+    return (cursor_descend(cur, root, FALSE));
+}
+
+// Moves the cursor to the first key that is not smaller than data (or, when
+// strict is TRUE, to the first key greater than data) and returns its node,
+// or NULL when there is none.
+static const struct node *cursor_seek(const struct node *root, avl_key_t data, bool strict, struct avl_cursor *cur)
+{
+    const struct node *ptr = root;
+    int found = 0, cmp;
+
+    cur->depth = 0;
+    while (ptr != NULL)
+    {
+        cur->path[cur->depth++] = ptr;
+        cmp = KEY_CMP(data, ptr->data);
+        if (cmp < 0 || (cmp == 0 && !strict))
+        {
+            // ptr is a candidate, a better one can only be on its left
+            found = cur->depth;
+            if (cmp == 0)
+                break;
+            ptr = ptr->left;
+        }
+        else
+            ptr = ptr->right;
+    }
+    // the nodes below the last candidate are not part of its path
+    cur->depth = found;
+    return (cursor_node(cur));
+}
+
+const struct node *cursor_lower_bound(const struct node *root, avl_key_t data, struct avl_cursor *cur)
+{
+    return (cursor_seek(root, data, FALSE, cur));
+}
+
+const struct node *cursor_upper_bound(const struct node *root, avl_key_t data, struct avl_cursor *cur)
+{
+    return (cursor_seek(root, data, TRUE, cur));
+}
+
+// Steps to the in-order successor and returns it, or NULL at the end
+const struct node *cursor_next(struct avl_cursor *cur)
+{
+    const struct node *ptr = cursor_node(cur);
+
+    if (ptr == NULL)
+        return (NULL);
+    if (ptr->right != NULL) // the successor is the left-most node of the right sub-tree
+        return (cursor_descend(cur, ptr->right, TRUE));
+    // otherwise it is the first ancestor that has the current node on its left
+    do
+        ptr = cur->path[--cur->depth];
+    while (cur->depth > 0 && cur->path[cur->depth - 1]->right == ptr);
+    return (cursor_node(cur));
+}
+
+// Steps to the in-order predecessor and returns it, or NULL at the start
+const struct node *cursor_prev(struct avl_cursor *cur)
+{
+    const struct node *ptr = cursor_node(cur);
+
+    if (ptr == NULL)
+        return (NULL);
+    if (ptr->left != NULL)
+        return (cursor_descend(cur, ptr->left, FALSE));
+    do
+        ptr = cur->path[--cur->depth];
+    while (cur->depth > 0 && cur->path[cur->depth - 1]->left == ptr);
+    return (cursor_node(cur));
+}
+
+// Calls visit() for every node whose key lies in [lo, hi), in increasing
+// order, until visit() returns FALSE. Returns the number of nodes visited.
+// Takes O(log n + k) time for k keys and allocates nothing.
+size_t range_scan(const struct node *root, avl_key_t lo, avl_key_t hi,
+                  bool (*visit)(void *ctx, const struct node *ptr), void *ctx)
+{
+    struct avl_cursor cur;
+    const struct node *ptr;
+    size_t count = 0;
+
+    for (ptr = cursor_lower_bound(root, lo, &cur); ptr != NULL && KEY_CMP(ptr->data, hi) < 0; ptr = cursor_next(&cur))
+    {
+        count++;
+        if (!visit(ctx, ptr))
+            break;
+    }
+    return (count);
+}
+
+// Copies the keys in [lo, hi) into out[], at most max of them, in increasing
+// order. Returns the number of keys copied.
+size_t range_copy(const struct node *root, avl_key_t lo, avl_key_t hi, avl_key_t *out, size_t max)
+{
+    struct avl_cursor cur;
+    const struct node *ptr;
+    size_t count = 0;
+
+    for (ptr = cursor_lower_bound(root, lo, &cur); count < max && ptr != NULL && KEY_CMP(ptr->data, hi) < 0; ptr = cursor_next(&cur))
+        out[count++] = ptr->data;
+    return (count);
+}
+
+void display(struct node *ptr, int level)
+{
+    int i;
+    if (ptr != NULL)
+    {
+        display(ptr->right, level + 1);
+        printf("\n");
+        for (i = 0; i < level; i++)
+            printf("    ");
+        printf(KEY_FORMAT, ptr->data);
+        display(ptr->left, level + 1);
+    } 
+}
+
+void inorder(struct node *ptr)
+{
+    struct avl_cursor cur;
+    const struct node *pos;
+
+    for (pos = cursor_first(ptr, &cur); pos != NULL; pos = cursor_next(&cur))
+        printf(" " KEY_FORMAT, pos->data);
+}
+
+struct node *findLargestElement(struct node *tree)
+{
+    if (tree != NULL)
+        while (tree->right != NULL)
+            tree = tree->right;
+    return tree;
+}
+
+// Restores the AVL balance after a node was unlinked at path[depth], with the
+// links as in insert_rebalance(). A rotation also moves the sibling of the
+// path and one of its children. When the tree shares those nodes with another
+// version, unshare() is called to get a private copy of each before it is
+// changed; delete() passes NULL and rotates in place.
+#ifdef AVL_RELAXED
+void delete_rebalance(struct node **path[], int depth, struct avl_stats *stats,
+                      struct node *(*unshare)(void *ctx, struct node *ptr), void *ctx)
+{
+    struct node **link, *tree;
+    int change;
+
+    // Walk back up while the sub-tree below keeps shrinking. A node is one
+    // level lower when the side that shrank was the higher one.
+    while (depth-- > 0)
+    {
+        link = path[depth];
+        tree = *link;
+        if (path[depth + 1] == &tree->left)
+            change = -(tree->balance-- > 0);
+        else
+            change = -(tree->balance++ < 0);
+        if (tree->balance > AVL_MAX_BALANCE || tree->balance < -AVL_MAX_BALANCE)
+            change += relaxed_rotate(link, TRUE, stats, unshare, ctx);
+        if (change == 0)
+            break;
+    }
+}
+#else
+void delete_rebalance(struct node **path[], int depth, struct avl_stats *stats,
+                      struct node *(*unshare)(void *ctx, struct node *ptr), void *ctx)
+{
+    struct node **link, *tree, *aptr, *bptr;
+
+    // Walk back up. The sub-tree below each node on the path has shrunk by one
+    // level; stop at the first node whose height does not change.
+    while (depth-- > 0)
+    {
+        link = path[depth];
+        tree = *link;
+        if (path[depth + 1] == &tree->left) // the left sub-tree has shrunk
+        {
+            if (tree->balance == 1) /* Left heavy */
+            {
+                // the node was left heavy and has become balanced, so it is
+                // one level lower and its parent has to be checked too
+                tree->balance = 0;
+                continue;
+            }
+            if (tree->balance == 0) /* Balanced */
+            {
+                // the node was balanced and has become right heavy, its height is unchanged
+                tree->balance = -1;
+                break;
+            }
+            // the node was right heavy and has become an unbalanced sub-tree.
+            // Rebalancing rotation is needed - determine the type from B's balance
+            aptr = tree->right; // "tree" is A and "aptr" is B
+            if (unshare != NULL)
+                aptr = tree->right = unshare(ctx, aptr);
+            if (aptr->balance == 0)
+            {
+                // L0 rotation: the sub-tree keeps its height
+                stats->rot_l0++;
+                TRACE("L0 Rotation");
+                tree->right = aptr->left;
+                aptr->left = tree;
+                tree->balance = -1;
+                aptr->balance = 1;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                *link = aptr;
+                break;
+            }
+            if (aptr->balance == -1)
+            {
+                // L-1 rotation
+                stats->rot_lm1++;
+                TRACE("L-1 Rotation");
+                tree->right = aptr->left;
+                aptr->left = tree;
+                tree->balance = 0;
+                aptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                *link = aptr;
+            }
+            else // aptr->balance == 1
+            {
+                // L1 rotation: tree = A, aptr = B and bptr = C
+                stats->rot_l1++;
+                TRACE("L1 Rotation");
+                bptr = aptr->left;
+                if (unshare != NULL)
+                    bptr = unshare(ctx, bptr);
+                aptr->left = bptr->right;
+                bptr->right = aptr;
+                tree->right = bptr->left;
+                bptr->left = tree;
+                tree->balance = (bptr->balance == -1) ? 1 : 0;
+                aptr->balance = (bptr->balance == 1) ? -1 : 0;
+                bptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                UPDATE_SIZE(bptr);
+                *link = bptr;
+            }
+        }
+        else // the right sub-tree has shrunk
+        {
+            if (tree->balance == -1) /* Right heavy */
+            {
+                // the node was right heavy and has become balanced, so it is
+                // one level lower and its parent has to be checked too
+                tree->balance = 0;
+                continue;
+            }
+            if (tree->balance == 0) /* Balanced */
+            {
+                // the node was balanced and has become left heavy, its height is unchanged
+                tree->balance = 1;
+                break;
+            }
+            // the node was left heavy and has become an unbalanced sub-tree.
+            // Rebalancing rotation is needed - determine the type from B's balance
+            aptr = tree->left; // "tree" is A and "aptr" is B (see slides 51 and 53)
+            if (unshare != NULL)
+                aptr = tree->left = unshare(ctx, aptr);
+            if (aptr->balance == 0)
+            {
+                // R0 rotation: the sub-tree keeps its height
+                stats->rot_r0++;
+                TRACE("R0 Rotation");
+                tree->left = aptr->right;
+                aptr->right = tree;
+                tree->balance = 1;
+                aptr->balance = -1;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                *link = aptr;
+                break;
+            }
+            if (aptr->balance == 1)
+            {
+                // R1 rotation
+                stats->rot_r1++;
+                TRACE("R1 Rotation");
+                tree->left = aptr->right;
+                aptr->right = tree;
+                tree->balance = 0;
+                aptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                *link = aptr;
+            }
+            else // aptr->balance == -1
+            {
+                // R-1 rotation: tree = A, aptr = B and bptr = C
+                stats->rot_rm1++;
+                TRACE("R-1 Rotation");
+                bptr = aptr->right;
+                if (unshare != NULL)
+                    bptr = unshare(ctx, bptr);
+                aptr->right = bptr->left;
+                bptr->left = aptr;
+                tree->left = bptr->right;
+                bptr->right = tree;
+                tree->balance = (bptr->balance == 1) ? -1 : 0;
+                aptr->balance = (bptr->balance == -1) ? 1 : 0;
+                bptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                UPDATE_SIZE(bptr);
+                *link = bptr;
+            }
+        }
+        // after the R1, R-1, L-1 and L1 rotations the sub-tree is one level
+        // lower than before the deletion, so re-balancing goes on upwards
+    }
+}
+#endif
+
+// Removes data from the tree. Returns TRUE when data was in the tree and has
+// been removed, and FALSE when the descent ended without finding it (nothing
+// is changed then).
+bool delete(struct avl_tree *avl, avl_key_t data)
+{
+    // path[i] is the link that holds the node at depth i, as in insert()
+    struct node **path[AVL_MAX_HEIGHT + 1];
+    struct node **link = &avl->root;
+    struct node *ptr, *tree;
+    int depth = 0, cmp;
+#ifdef AVL_INSTRUMENT
+    uint64_t start = instrument_clock();
+    size_t rotations = stats_rotations(&avl->stats);
+#endif
+
+    // Find the node to delete
+    while ((tree = *link) != NULL && (cmp = KEY_CMP(data, tree->data)) != 0)
+    {
+        path[depth++] = link;
+        link = (cmp < 0) ? &tree->left : &tree->right;
+    }
+    avl->stats.comparisons += depth + (tree != NULL);
+    if (tree == NULL)
+    {
+#ifdef AVL_INSTRUMENT
+        instrument_record(&avl->instrument, AVL_OP_DELETE, start, depth, 0);
+#endif
+        return (FALSE); // there is nothing to delete
+    }
+
+    if (tree->left && tree->right) // if there are subtrees
+    {
+        // Find the in-order predecessor in the same descent, move its value up
+        // and unlink the predecessor node instead. It has no right child.
+        path[depth++] = link;
+        link = &tree->left;
+        while ((ptr = *link)->right != NULL)
+        {
+            path[depth++] = link;
+            link = &ptr->right;
+        }
+        tree->data = ptr->data;
+        tree->value = ptr->value;
+        *link = ptr->left;
+    }
+    else // at least one child is absent
+    {
+        // if the node has a child (but not both) it is replaced by the child,
+        // otherwise the link becomes NULL
+        ptr = tree;
+        *link = (tree->left != NULL) ? tree->left : tree->right;
+    }
+    // Delete the unlinked node, it goes back to the pool
+    pool_free(&avl->pool, ptr);
+    avl->count--;
+    path[depth] = link;
+    if (depth > avl->stats.max_depth)
+        avl->stats.max_depth = depth;
+#ifdef AVL_ORDER_STATS
+    // every sub-tree on the path has lost a node
+    for (int i = 0; i < depth; i++)
+        (*path[i])->size--;
+#endif
+
+    // Then re-balance on the way back up
+    delete_rebalance(path, depth, &avl->stats, NULL, NULL);
+#ifdef AVL_INSTRUMENT
+    instrument_record(&avl->instrument, AVL_OP_DELETE, start, depth + 1, stats_rotations(&avl->stats) - rotations);
+#endif
+    return (TRUE);
+}
+
+#ifdef AVL_ORDER_STATS
+// Returns the number of keys in the tree that are smaller than data, or that
+// are smaller or equal when inclusive is TRUE.
+static size_t count_below(const struct node *ptr, avl_key_t data, bool inclusive)
+{
+    size_t below = 0;
+    int cmp;
+
+    while (ptr != NULL)
+    {
+        cmp = KEY_CMP(data, ptr->data);
+        if (cmp < 0 || (cmp == 0 && !inclusive))
+            ptr = ptr->left;
+        else
+        {
+            // ptr and its whole left sub-tree are below data
+            below += NODE_SIZE(ptr->left) + 1;
+            if (cmp == 0)
+                break;
+            ptr = ptr->right;
+        }
+    }
+    return (below);
+}
+
+// Rank of data: the number of keys smaller than it, which is also the
+// position data has or would have in the in-order sequence, counting from 0.
+size_t avl_rank(const struct avl_tree *avl, avl_key_t data)
+{
+    return (count_below(avl->root, data, FALSE));
+}
+
+// Returns the node holding the k-th smallest key, counting from 0, or NULL
+// when the tree has k nodes or less.
+struct node *avl_select(const struct avl_tree *avl, size_t k)
+{
+    struct node *ptr = avl->root;
+    size_t left;
+
+    while (ptr != NULL)
+    {
+        left = NODE_SIZE(ptr->left);
+        if (k == left)
+            break;
+        if (k < left)
+            ptr = ptr->left;
+        else
+        {
+            k -= left + 1;
+            ptr = ptr->right;
+        }
+    }
+    return (ptr);
+}
+
+// Number of keys in the closed range [lo, hi]
+size_t avl_count_range(const struct avl_tree *avl, avl_key_t lo, avl_key_t hi)
+{
+    if (KEY_CMP(lo, hi) > 0)
+        return (0);
+    return (count_below(avl->root, hi, TRUE) - count_below(avl->root, lo, FALSE));
+}
+#endif
+
+// Checks the sub-tree below ptr, which sits at the given depth: the data must
+// come in increasing order (*prev is the node visited before in in-order),
+// every balance factor must be the height difference of the two sub-trees,
+// and that difference must be -1, 0 or 1 (up to 2 either way with
+// AVL_RELAXED). With AVL_ORDER_STATS the size
+// field must match too. The height is returned through *height and the nodes
+// of the sub-tree are added to *count.
+static bool validate_node(const struct node *ptr, int depth, const struct node **prev, int *height, size_t *count)
+{
+    size_t before = *count;
+    int lh, rh;
+
+    if (ptr == NULL)
+    {
+        *height = 0;
+        return (TRUE);
+    }
+    if (depth > AVL_MAX_HEIGHT) // deeper than any AVL tree can be, the links are broken
+        return (FALSE);
+    if (!validate_node(ptr->left, depth + 1, prev, &lh, count))
+        return (FALSE);
+    if (*prev != NULL && KEY_CMP((*prev)->data, ptr->data) >= 0)
+        return (FALSE);
+    *prev = ptr;
+    (*count)++;
+    if (!validate_node(ptr->right, depth + 1, prev, &rh, count))
+        return (FALSE);
+    if (ptr->balance != lh - rh || ptr->balance < -AVL_MAX_BALANCE || ptr->balance > AVL_MAX_BALANCE)
+        return (FALSE);
+#ifdef AVL_ORDER_STATS
+    if (ptr->size != *count - before)
+        return (FALSE);
+#else
+    (void)before;
+#endif
+    *height = max(lh, rh) + 1;
+    return (TRUE);
+}
+
+// Returns TRUE when the tree is a valid AVL tree: ordered, with correct
+// balance factors, and holding as many nodes as it counts. Takes O(n) time,
+// it is meant for tests and debugging, not for the hot path.
+bool validate(const struct avl_tree *avl)
+{
+    const struct node *prev = NULL;
+    size_t count = 0;
+    int height;
+
+    return (validate_node(avl->root, 0, &prev, &height, &count) && count == avl->count);
+}
+
+// Links the nodes block[lo] .. block[hi - 1], whose data is already in
+// increasing order, into a perfectly balanced sub-tree and returns its root.
+// The middle node becomes the root, so the left half is never smaller than
+// the right one and every balance factor is 0 or 1. *height receives the
+// height of the sub-tree.
+static struct node *link_balanced(struct node *block, size_t lo, size_t hi, int *height)
+{
+    struct node *ptr;
+    size_t mid;
+    int lh, rh;
+
+    if (lo == hi)
+    {
+        *height = 0;
+        return (NULL);
+    }
+    mid = lo + (hi - lo) / 2;
+    ptr = &block[mid];
+    ptr->left = link_balanced(block, lo, mid, &lh);
+    ptr->right = link_balanced(block, mid + 1, hi, &rh);
+    ptr->balance = lh - rh;
+    UPDATE_SIZE(ptr);
+    *height = max(lh, rh) + 1;
+    return (ptr);
+}
+
+// Bulk loading. The tree is emptied and rebuilt from keys that arrive in
+// increasing order, in O(n) time and without rotations: the nodes are taken
+// as one contiguous block, filled in in-order, and then linked by position.
+// Keys equal to the previous one are skipped. Nodes of the block that are not
+// needed because of skipped keys go onto the free list.
+// The functions return 0 on success, and -1 when the keys are out of order or
+// the system is out of memory; the tree is left empty in that case.
+int avl_build_stream(struct avl_tree *avl, size_t n,
+                     bool (*next)(void *ctx, avl_key_t *data, avl_value_t *value), void *ctx)
+{
+    struct node *block, *ptr;
+    size_t count = 0;
+    int height;
+
+    avl_destroy(avl);
+    if (n == 0)
+        return (0);
+    block = pool_alloc_block(&avl->pool, n);
+    if (block == NULL)
+        return (-1);
+    while (count < n)
+    {
+        ptr = &block[count];
+        if (!next(ctx, &ptr->data, &ptr->value))
+            break;
+        if (count > 0 && KEY_CMP(ptr->data, block[count - 1].data) <= 0)
+        {
+            if (KEY_CMP(ptr->data, block[count - 1].data) == 0)
+                continue; // duplicate value ignored
+            avl_destroy(avl);
+            return (-1);
+        }
+        count++;
+    }
+    while (n > count) // hand back the tail that was not used
+        pool_free(&avl->pool, &block[--n]);
+    avl->root = link_balanced(block, 0, count, &height);
+    avl->count = count;
+    avl->stats.allocations += count;
+    return (0);
+}
+
+struct key_cursor
+{
+    const avl_key_t *keys;
+    const avl_value_t *values; // may be NULL, the values are zero then
+    size_t n;
+    size_t i;
+};
+
+static bool next_key(void *ctx, avl_key_t *data, avl_value_t *value)
+{
+    struct key_cursor *cur = (struct key_cursor *)ctx;
+    if (cur->i == cur->n)
+        return (FALSE);
+    *data = cur->keys[cur->i];
+    *value = (cur->values != NULL) ? cur->values[cur->i] : zero_value;
+    cur->i++;
+    return (TRUE);
+}
+
+// Builds the tree from keys sorted in increasing order. values[i] is stored
+// with keys[i]; values may be NULL.
+int avl_build_sorted(struct avl_tree *avl, const avl_key_t *keys, const avl_value_t *values, size_t n)
+{
+    struct key_cursor cur = {keys, values, n, 0};
+    return (avl_build_stream(avl, n, next_key, &cur));
+}
+
+struct key_value
+{
+    avl_key_t key;
+    avl_value_t value;
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+    return (KEY_CMP(((const struct key_value *)a)->key, ((const struct key_value *)b)->key));
+}
+
+struct entry_cursor
+{
+    const struct key_value *entries;
+    size_t n;
+    size_t i;
+};
+
+static bool next_entry(void *ctx, avl_key_t *data, avl_value_t *value)
+{
+    struct entry_cursor *cur = (struct entry_cursor *)ctx;
+    if (cur->i == cur->n)
+        return (FALSE);
+    *data = cur->entries[cur->i].key;
+    *value = cur->entries[cur->i].value;
+    cur->i++;
+    return (TRUE);
+}
+
+// Builds the tree from keys in any order. Input that is not already sorted is
+// copied and sorted first; duplicates are dropped by the build, and which of
+// their values is kept is unspecified.
+int avl_build(struct avl_tree *avl, const avl_key_t *keys, const avl_value_t *values, size_t n)
+{
+    struct key_value *entries;
+    struct entry_cursor cur;
+    size_t i;
+    int result;
+
+    for (i = 1; i < n && KEY_CMP(keys[i - 1], keys[i]) <= 0; i++)
+        ;
+    if (i >= n)
+        return (avl_build_sorted(avl, keys, values, n));
+    entries = (struct key_value *)malloc(n * sizeof(struct key_value));
+    if (entries == NULL)
+    {
+        avl_destroy(avl);
+        return (-1);
+    }
+    for (i = 0; i < n; i++)
+    {
+        entries[i].key = keys[i];
+        entries[i].value = (values != NULL) ? values[i] : zero_value;
+    }
+    qsort(entries, n, sizeof(struct key_value), compare_entries);
+    cur.entries = entries;
+    cur.n = n;
+    cur.i = 0;
+    result = avl_build_stream(avl, n, next_entry, &cur);
+    free(entries);
+    return (result);
+}
+
+// Split and join. Both take the heights of the trees they are given and
+// return the height of the trees they make, so no height has to be stored in
+// the nodes: it follows from the height of the parent and its balance factor.
+
+// Height of the sub-tree below ptr, found by following the higher side
+int tree_height(const struct node *ptr)
+{
+    int h = 0;
+    for (; ptr != NULL; h++)
+        ptr = (ptr->balance > 0) ? ptr->left : ptr->right;
+    return (h);
+}
+
+// Joins the trees left and right, of heights lh and rh, with the node mid,
+// whose data lies between theirs. Returns the root of the joined tree and its
+// height through *height. When one tree is more than one level higher than
+// the other, mid is hung into its spine next to the first sub-tree that is
+// not, which makes that place one level higher, as an insertion does. Walking
+// back up, the growth is absorbed or rotated away as in insert(), except that
+// the sub-tree below mid may be balanced; then a single rotation does not stop
+// the growth, like the L0/R0 case of delete(). Takes O(|lh - rh| + 1) time.
+#ifdef AVL_RELAXED
+// With relaxed balancing the same join is done for any bound on the balance
+// factors, which avl_rebalance() uses with 1 to make a node strictly balanced
+// again. mid goes next to the first sub-tree of the spine that is at most
+// bound levels higher than the other tree; that makes it exactly one level
+// higher, and the growth is handled on the way up as in insert_rebalance().
+static struct node *join_bounded(struct node *left, int lh, struct node *mid, struct node *right, int rh,
+                                 int *height, struct avl_stats *stats, int bound)
+{
+    struct node **path[AVL_MAX_HEIGHT + 1];
+    struct node **link, *root;
+    int depth = 0, h, grown = 1;
+
+    if (lh <= rh + bound && rh <= lh + bound)
+    {
+        mid->left = left;
+        mid->right = right;
+        mid->balance = lh - rh;
+        UPDATE_SIZE(mid);
+        *height = max(lh, rh) + 1;
+        return (mid);
+    }
+    if (lh > rh) // go down the right spine of left
+    {
+        root = left;
+        link = &root;
+        for (h = lh; h > rh + bound; link = &(*link)->right)
+        {
+            path[depth++] = link;
+            h = RIGHT_HEIGHT(*link, h);
+        }
+        mid->left = *link;
+        mid->right = right;
+        mid->balance = h - rh;
+    }
+    else // right is higher, go down its left spine
+    {
+        root = right;
+        link = &root;
+        for (h = rh; h > lh + bound; link = &(*link)->left)
+        {
+            path[depth++] = link;
+            h = LEFT_HEIGHT(*link, h);
+        }
+        mid->left = left;
+        mid->right = *link;
+        mid->balance = lh - h;
+    }
+    UPDATE_SIZE(mid);
+    *link = mid;
+    while (depth-- > 0)
+    {
+        link = path[depth];
+        if (grown)
+        {
+            grown = (lh > rh) ? ((*link)->balance-- <= 0) : ((*link)->balance++ >= 0);
+            if ((*link)->balance > bound || (*link)->balance < -bound)
+                grown += relaxed_rotate(link, FALSE, stats, NULL, NULL);
+        }
+        UPDATE_SIZE(*link);
+    }
+    *height = max(lh, rh) + grown;
+    return (root);
+}
+
+struct node *tree_join(struct node *left, int lh, struct node *mid, struct node *right, int rh,
+                       int *height, struct avl_stats *stats)
+{
+    return (join_bounded(left, lh, mid, right, rh, height, stats, AVL_MAX_BALANCE));
+}
+#else
+struct node *tree_join(struct node *left, int lh, struct node *mid, struct node *right, int rh,
+                       int *height, struct avl_stats *stats)
+{
+    struct node **path[AVL_MAX_HEIGHT + 1];
+    struct node **link, *root, *tree, *aptr, *bptr;
+    int depth = 0, h;
+    bool grown = TRUE;
+
+    if (lh <= rh + 1 && rh <= lh + 1)
+    {
+        mid->left = left;
+        mid->right = right;
+        mid->balance = lh - rh;
+        UPDATE_SIZE(mid);
+        *height = max(lh, rh) + 1;
+        return (mid);
+    }
+    if (lh > rh) // go down the right spine of left
+    {
+        root = left;
+        link = &root;
+        for (h = lh; h > rh + 1; link = &(*link)->right)
+        {
+            path[depth++] = link;
+            h = RIGHT_HEIGHT(*link, h);
+        }
+        mid->left = *link;
+        mid->right = right;
+        mid->balance = h - rh;
+        UPDATE_SIZE(mid);
+        *link = mid;
+        while (depth-- > 0)
+        {
+            link = path[depth];
+            tree = *link;
+            if (!grown || tree->balance == 1)
+            {
+                if (grown)
+                    tree->balance = 0; // the node was left heavy and has become balanced
+                grown = FALSE;
+                UPDATE_SIZE(tree);
+                continue;
+            }
+            if (tree->balance == 0)
+            {
+                tree->balance = -1;
+                UPDATE_SIZE(tree);
+                continue;
+            }
+            aptr = tree->right;
+            if (aptr->balance == 1)
+            {
+                // RL rotation, as in insert()
+                stats->rot_rl++;
+                bptr = aptr->left;
+                aptr->left = bptr->right;
+                bptr->right = aptr;
+                tree->right = bptr->left;
+                bptr->left = tree;
+                tree->balance = (bptr->balance == -1) ? 1 : 0;
+                aptr->balance = (bptr->balance == 1) ? -1 : 0;
+                bptr->balance = 0;
+                UPDATE_SIZE(tree);
+                UPDATE_SIZE(aptr);
+                UPDATE_SIZE(bptr);
+                *link = bptr;
+                grown = FALSE;
+                continue;
+            }
+            // RR rotation, which leaves the sub-tree one level higher when B was balanced
+            stats->rot_rr++;
+            tree->right = aptr->left;
+            aptr->left = tree;
+            grown = (aptr->balance == 0);
+            tree->balance = grown ? -1 : 0;
+            aptr->balance = grown ? 1 : 0;
+            UPDATE_SIZE(tree);
+            UPDATE_SIZE(aptr);
+            *link = aptr;
+        }
+        *height = lh + grown;
+        return (root);
+    }
+    // right is higher, go down its left spine
+    root = right;
+    link = &root;
+    for (h = rh; h > lh + 1; link = &(*link)->left)
+    {
+        path[depth++] = link;
+        h = LEFT_HEIGHT(*link, h);
+    }
+    mid->left = left;
+    mid->right = *link;
+    mid->balance = lh - h;
+    UPDATE_SIZE(mid);
+    *link = mid;
+    while (depth-- > 0)
+    {
+        link = path[depth];
+        tree = *link;
+        if (!grown || tree->balance == -1)
+        {
+            if (grown)
+                tree->balance = 0; // the node was right heavy and has become balanced
+            grown = FALSE;
+            UPDATE_SIZE(tree);
+            continue;
+        }
+        if (tree->balance == 0)
+        {
+            tree->balance = 1;
+            UPDATE_SIZE(tree);
+            continue;
+        }
+        aptr = tree->left;
+        if (aptr->balance == -1)
+        {
+            // LR rotation, as in insert()
+            stats->rot_lr++;
+            bptr = aptr->right;
+            aptr->right = bptr->left;
+            bptr->left = aptr;
+            tree->left = bptr->right;
+            bptr->right = tree;
+            tree->balance = (bptr->balance == 1) ? -1 : 0;
+            aptr->balance = (bptr->balance == -1) ? 1 : 0;
+            bptr->balance = 0;
+            UPDATE_SIZE(tree);
+            UPDATE_SIZE(aptr);
+            UPDATE_SIZE(bptr);
+            *link = bptr;
+            grown = FALSE;
+            continue;
+        }
+        // LL rotation, which leaves the sub-tree one level higher when B was balanced
+        stats->rot_ll++;
+        tree->left = aptr->right;
+        aptr->right = tree;
+        grown = (aptr->balance == 0);
+        tree->balance = grown ? 1 : 0;
+        aptr->balance = grown ? -1 : 0;
+        UPDATE_SIZE(tree);
+        UPDATE_SIZE(aptr);
+        *link = aptr;
+    }
+    *height = rh + grown;
+    return (root);
+}
+#endif
+
+// Splits the tree below ptr, of height h, into the nodes whose data is
+// smaller than data and those whose data is larger. The two trees and their
+// heights are returned through the other pointers. Returns the node holding
+// data, which belongs to neither tree, or NULL. Walking back up the search
+// path, every node is joined with its other sub-tree onto the tree of its
+// side; the costs of these joins add up to O(log n).
+struct node *tree_split(struct node *ptr, int h, avl_key_t data, struct node **left, int *lh,
+                        struct node **right, int *rh, struct avl_stats *stats)
+{
+    struct node *path[AVL_MAX_HEIGHT];
+    int heights[AVL_MAX_HEIGHT];
+    bool went_left[AVL_MAX_HEIGHT];
+    struct node *found, *tree;
+    int depth = 0, cmp;
+
+    while (ptr != NULL && (cmp = KEY_CMP(data, ptr->data)) != 0)
+    {
+        path[depth] = ptr;
+        heights[depth] = h;
+        went_left[depth++] = (cmp < 0);
+        h = (cmp < 0) ? LEFT_HEIGHT(ptr, h) : RIGHT_HEIGHT(ptr, h);
+        ptr = (cmp < 0) ? ptr->left : ptr->right;
+    }
+    stats->comparisons += depth + (ptr != NULL);
+    found = ptr;
+    *left = *right = NULL;
+    *lh = *rh = 0;
+    if (found != NULL)
+    {
+        *left = found->left;
+        *lh = LEFT_HEIGHT(found, h);
+        *right = found->right;
+        *rh = RIGHT_HEIGHT(found, h);
+    }
+    while (depth-- > 0)
+    {
+        tree = path[depth];
+        h = heights[depth];
+        if (went_left[depth]) // tree and its right sub-tree are larger than data
+            *right = tree_join(*right, *rh, tree, tree->right, RIGHT_HEIGHT(tree, h), rh, stats);
+        else
+            *left = tree_join(tree->left, LEFT_HEIGHT(tree, h), tree, *left, *lh, lh, stats);
+    }
+    return (found);
+}
+
+// Joins left and right without a node between them: the largest node of
+// left is split off and takes that place
+struct node *tree_join2(struct node *left, int lh, struct node *right, int rh, int *height, struct avl_stats *stats)
+{
+    struct node *mid, *rest, *none;
+    int resth, noneh;
+
+    if (left == NULL)
+    {
+        *height = rh;
+        return (right);
+    }
+    mid = tree_split(left, lh, findLargestElement(left)->data, &rest, &resth, &none, &noneh, stats);
+    return (tree_join(rest, resth, mid, right, rh, height, stats));
+}
+
+#ifdef AVL_RELAXED
+// Makes the sub-tree below *link strictly balanced, bottom-up: once both
+// sub-trees of a node are, the node is joined with them as a strict join
+// would, which only costs a rotation or two where they differ by more than a
+// level. Returns the height.
+static int rebalance_node(struct node **link, struct avl_stats *stats)
+{
+    struct node *ptr = *link;
+    int lh, rh, h;
+
+    if (ptr == NULL)
+        return (0);
+    lh = rebalance_node(&ptr->left, stats);
+    rh = rebalance_node(&ptr->right, stats);
+    if (lh - rh >= -1 && lh - rh <= 1)
+    {
+        if (ptr->balance != lh - rh) // a sub-tree has become lower
+            ptr->balance = lh - rh;
+        return (max(lh, rh) + 1);
+    }
+    *link = join_bounded(ptr->left, lh, ptr, ptr->right, rh, &h, stats, 1);
+    return (h);
+}
+#endif
+
+// The deferred half of relaxed balancing: brings every balance factor back
+// to -1, 0 or 1, so that lookups find a strict AVL tree until the next
+// updates. Takes O(n) time and is meant to run when the writers are idle.
+// Without AVL_RELAXED the tree is always strictly balanced and nothing is done.
+void avl_rebalance(struct avl_tree *avl)
+{
+#ifdef AVL_RELAXED
+    rebalance_node(&avl->root, &avl->stats);
+#else
+    (void)avl;
+#endif
+}
+
+// Batches. The keys are sorted first, then the batch and the tree are split
+// against each other: the root of a sub-tree divides the keys of the batch
+// that go to its left and to its right sub-tree, both sides are handled on
+// their own, and the results are joined again with the root. A sub-tree that
+// no key of the batch falls into is not entered at all, and a range of new
+// keys that falls into an empty place is linked into a balanced sub-tree in
+// one go, so for m keys in a tree of n the work is O(m log(n/m + 1)) instead
+// of the O(m log n) of one insert() or delete() per key.
+
+struct batch
+{
+    struct avl_tree *avl;
+    const struct key_value *entries; // sorted, without duplicates
+    struct node *spare;              // nodes for new keys, chained through right
+};
+
+// Sorts keys into a new array of entries and drops duplicates. *m receives
+// the number of entries. Returns NULL when the system is out of memory.
+static struct key_value *sort_batch(const avl_key_t *keys, const avl_value_t *values, size_t n, size_t *m)
+{
+    struct key_value *entries;
+    size_t i, j;
+
+    entries = (struct key_value *)malloc((n > 0 ? n : 1) * sizeof(struct key_value));
+    if (entries == NULL)
+        return (NULL);
+    for (i = 0; i < n; i++)
+    {
+        entries[i].key = keys[i];
+        entries[i].value = (values != NULL) ? values[i] : zero_value;
+    }
+    for (i = 1; i < n && KEY_CMP(entries[i - 1].key, entries[i].key) < 0; i++)
+        ;
+    if (i < n)
+        qsort(entries, n, sizeof(struct key_value), compare_entries);
+    for (i = j = 0; i < n; i++)
+        if (j == 0 || KEY_CMP(entries[j - 1].key, entries[i].key) != 0)
+            entries[j++] = entries[i];
+    *m = j;
+    return (entries);
+}
+
+// Index of the first entry in [lo, hi) whose key is not smaller than data
+static size_t batch_lower_bound(const struct batch *b, size_t lo, size_t hi, avl_key_t data)
+{
+    size_t mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        b->avl->stats.comparisons++;
+        if (KEY_CMP(b->entries[mid].key, data) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo);
+}
+
+// Links new nodes for entries lo .. hi - 1 into a balanced sub-tree, the
+// same shape link_balanced() makes
+static struct node *batch_build(struct batch *b, size_t lo, size_t hi, int *height)
+{
+    struct node *ptr;
+    size_t mid;
+    int lh, rh;
+
+    if (lo == hi)
+    {
+        *height = 0;
+        return (NULL);
+    }
+    mid = lo + (hi - lo) / 2;
+    ptr = b->spare;
+    b->spare = ptr->right;
+    ptr->data = b->entries[mid].key;
+    ptr->value = b->entries[mid].value;
+    ptr->left = batch_build(b, lo, mid, &lh);
+    ptr->right = batch_build(b, mid + 1, hi, &rh);
+    ptr->balance = lh - rh;
+    UPDATE_SIZE(ptr);
+    *height = max(lh, rh) + 1;
+    b->avl->count++;
+    return (ptr);
+}
+
+// Adds entries lo .. hi - 1 to the sub-tree below ptr, of height h
+static struct node *batch_insert(struct batch *b, struct node *ptr, int h, size_t lo, size_t hi, int *height)
+{
+    struct node *left, *right;
+    size_t mid;
+    int lh, rh;
+    bool found;
+
+    if (lo == hi)
+    {
+        *height = h;
+        return (ptr);
+    }
+    if (ptr == NULL)
+        return (batch_build(b, lo, hi, height));
+    mid = batch_lower_bound(b, lo, hi, ptr->data);
+    found = (mid < hi && KEY_CMP(b->entries[mid].key, ptr->data) == 0);
+    left = batch_insert(b, ptr->left, LEFT_HEIGHT(ptr, h), lo, mid, &lh);
+    right = batch_insert(b, ptr->right, RIGHT_HEIGHT(ptr, h), mid + found, hi, &rh);
+    return (tree_join(left, lh, ptr, right, rh, height, &b->avl->stats));
+}
+
+// Removes entries lo .. hi - 1 from the sub-tree below ptr, of height h
+static struct node *batch_delete(struct batch *b, struct node *ptr, int h, size_t lo, size_t hi, int *height)
+{
+    struct node *left, *right;
+    size_t mid;
+    int lh, rh;
+    bool found;
+
+    if (lo == hi || ptr == NULL)
+    {
+        *height = h;
+        return (ptr);
+    }
+    mid = batch_lower_bound(b, lo, hi, ptr->data);
+    found = (mid < hi && KEY_CMP(b->entries[mid].key, ptr->data) == 0);
+    left = batch_delete(b, ptr->left, LEFT_HEIGHT(ptr, h), lo, mid, &lh);
+    right = batch_delete(b, ptr->right, RIGHT_HEIGHT(ptr, h), mid + found, hi, &rh);
+    if (!found)
+        return (tree_join(left, lh, ptr, right, rh, height, &b->avl->stats));
+    pool_free(&b->avl->pool, ptr);
+    b->avl->count--;
+    return (tree_join2(left, lh, right, rh, height, &b->avl->stats));
+}
+
+// Inserts the n keys, in any order, with values[i] for keys[i]; values may
+// be NULL. Keys that are already in the tree keep their node and value, as
+// with insert(), and of duplicates within the batch one is kept. Returns the
+// number of keys inserted, or -1 when the system is out of memory, in which
+// case the tree is left as it was.
+long insert_batch(struct avl_tree *avl, const avl_key_t *keys, const avl_value_t *values, size_t n)
+{
+    struct batch b;
+    struct key_value *entries;
+    struct node *ptr;
+    size_t m, i, before = avl->count;
+    int height;
+
+    entries = sort_batch(keys, values, n, &m);
+    if (entries == NULL)
+        return (-1);
+    // Take a node for every key up front, so that running out of memory
+    // cannot leave the tree half done. The ones not needed go back.
+    b.avl = avl;
+    b.entries = entries;
+    b.spare = NULL;
+    for (i = 0; i < m; i++)
+    {
+        ptr = pool_alloc(&avl->pool);
+        if (ptr == NULL)
+        {
+            for (; b.spare != NULL; b.spare = ptr)
+            {
+                ptr = b.spare->right;
+                pool_free(&avl->pool, b.spare);
+            }
+            free(entries);
+            return (-1);
+        }
+        ptr->right = b.spare;
+        b.spare = ptr;
+    }
+    avl->root = batch_insert(&b, avl->root, tree_height(avl->root), 0, m, &height);
+    avl->stats.allocations += avl->count - before;
+    for (; b.spare != NULL; b.spare = ptr)
+    {
+        ptr = b.spare->right;
+        pool_free(&avl->pool, b.spare);
+    }
+    free(entries);
+    return ((long)(avl->count - before));
+}
+
+// Deletes the n keys, in any order; keys that are not in the tree are
+// ignored. Returns the number of keys deleted, or -1 when the system is out
+// of memory for sorting the batch, in which case the tree is left as it was.
+long delete_batch(struct avl_tree *avl, const avl_key_t *keys, size_t n)
+{
+    struct batch b;
+    struct key_value *entries;
+    size_t m, before = avl->count;
+    int height;
+
+    entries = sort_batch(keys, NULL, n, &m);
+    if (entries == NULL)
+        return (-1);
+    b.avl = avl;
+    b.entries = entries;
+    b.spare = NULL;
+    avl->root = batch_delete(&b, avl->root, tree_height(avl->root), 0, m, &height);
+    free(entries);
+    return ((long)(before - avl->count));
+}
+
+static void cnode_set_right(struct cnode *ptr, uint32_t right)
+{
+    ptr->right_bal = (right << 2) | (ptr->right_bal & 3);
+}
+
+static void cnode_set_balance(struct cnode *ptr, int balance)
+{
+    ptr->right_bal = (ptr->right_bal & ~3u) | (uint32_t)(balance + 1);
+}
+
+void compact_init(struct compact_tree *ct)
+{
+    ct->nodes = NULL;
+    ct->root = CNODE_NIL;
+    ct->count = 0;
+    ct->used = 1;
+    ct->capacity = 0;
+    ct->free_list = CNODE_NIL;
+}
+
+void compact_destroy(struct compact_tree *ct)
+{
+    free(ct->nodes);
+    compact_init(ct);
+}
+
+// Makes room for at least n more nodes. Returns FALSE when the array cannot
+// grow, either because the system is out of memory or because the indices
+// would not fit in 30 bits.
+bool compact_reserve(struct compact_tree *ct, size_t n)
+{
+    struct cnode *nodes;
+    size_t capacity = ct->capacity;
+
+    if (ct->used + n <= capacity)
+        return (TRUE);
+    if (ct->used + n > (size_t)CNODE_MAX + 1)
+        return (FALSE);
+    if (n > 1) // the caller knows the size it needs, so give exactly that
+        capacity = ct->used + n;
+    else if (capacity == 0)
+        capacity = CNODE_FIRST_CAPACITY;
+    else
+        capacity *= 2;
+    if (capacity > (size_t)CNODE_MAX + 1)
+        capacity = (size_t)CNODE_MAX + 1;
+    nodes = (struct cnode *)realloc(ct->nodes, capacity * sizeof(struct cnode));
+    if (nodes == NULL)
+        return (FALSE);
+    ct->nodes = nodes;
+    ct->capacity = (uint32_t)capacity;
+    return (TRUE);
+}
+
+// Returns the node holding data, or NULL. The pointer is only valid until the
+// next compact_insert(), which may move the array.
+struct cnode *compact_search(const struct compact_tree *ct, avl_key_t data)
+{
+    const struct cnode *nodes = ct->nodes;
+    uint32_t idx = ct->root;
+    int cmp;
+
+    while (idx != CNODE_NIL && (cmp = KEY_CMP(data, nodes[idx].data)) != 0)
+        idx = (cmp < 0) ? nodes[idx].left : CNODE_RIGHT(&nodes[idx]);
+    return (idx == CNODE_NIL ? NULL : &ct->nodes[idx]);
+}
+
+// Rebalances the sub-tree rooted at tree, whose left side has become two
+// levels higher than its right side, and returns the index of its new root.
+// *shrunk tells whether the sub-tree became one level lower by the rotation,
+// which is always the case after an insertion. This is the LL/LR case of
+// insert() and the R1/R0/R-1 case of delete().
+static uint32_t compact_fix_left(struct cnode *nodes, uint32_t tree, bool *shrunk)
+{
+    struct cnode *A = &nodes[tree];
+    uint32_t aptr = A->left, bptr;
+    struct cnode *B = &nodes[aptr], *C;
+    int bal = CNODE_BALANCE(B);
+
+    if (bal >= 0) // single rotation, B moves up to the A-place
+    {
+        A->left = CNODE_RIGHT(B);
+        cnode_set_right(B, tree);
+        cnode_set_balance(A, bal == 0 ? 1 : 0);
+        cnode_set_balance(B, bal == 0 ? -1 : 0);
+        *shrunk = (bal != 0);
+        return (aptr);
+    }
+    // double rotation, C moves up to the A-place
+    bptr = CNODE_RIGHT(B);
+    C = &nodes[bptr];
+    cnode_set_right(B, C->left);
+    C->left = aptr;
+    A->left = CNODE_RIGHT(C);
+    cnode_set_right(C, tree);
+    cnode_set_balance(A, CNODE_BALANCE(C) == 1 ? -1 : 0);
+    cnode_set_balance(B, CNODE_BALANCE(C) == -1 ? 1 : 0);
+    cnode_set_balance(C, 0);
+    *shrunk = TRUE;
+    return (bptr);
+}
+
+// Mirror image of compact_fix_left() for a sub-tree whose right side is two
+// levels higher: the RR/RL case of insert() and the L-1/L0/L1 case of delete().
+static uint32_t compact_fix_right(struct cnode *nodes, uint32_t tree, bool *shrunk)
+{
+    struct cnode *A = &nodes[tree];
+    uint32_t aptr = CNODE_RIGHT(A), bptr;
+    struct cnode *B = &nodes[aptr], *C;
+    int bal = CNODE_BALANCE(B);
+
+    if (bal <= 0)
+    {
+        cnode_set_right(A, B->left);
+        B->left = tree;
+        cnode_set_balance(A, bal == 0 ? -1 : 0);
+        cnode_set_balance(B, bal == 0 ? 1 : 0);
+        *shrunk = (bal != 0);
+        return (aptr);
+    }
+    bptr = B->left;
+    C = &nodes[bptr];
+    B->left = CNODE_RIGHT(C);
+    cnode_set_right(C, aptr);
+    cnode_set_right(A, C->left);
+    C->left = tree;
+    cnode_set_balance(A, CNODE_BALANCE(C) == -1 ? 1 : 0);
+    cnode_set_balance(B, CNODE_BALANCE(C) == 1 ? -1 : 0);
+    cnode_set_balance(C, 0);
+    *shrunk = TRUE;
+    return (bptr);
+}
+
+// Makes idx the child of path[depth - 1] on the side recorded in went_left,
+// or the root when depth is 0.
+static void compact_relink(struct compact_tree *ct, const uint32_t *path, const bool *went_left, int depth, uint32_t idx)
+{
+    if (depth == 0)
+        ct->root = idx;
+    else if (went_left[depth - 1])
+        ct->nodes[path[depth - 1]].left = idx;
+    else
+        cnode_set_right(&ct->nodes[path[depth - 1]], idx);
+}
+
+// Same contract as insert(), including the zero value of a new node. NULL is
+// returned when the array cannot grow. The returned pointer is only valid
+// until the next compact_insert().
+struct cnode *compact_insert(struct compact_tree *ct, avl_key_t data, bool *inserted)
+{
+    // path[i] is the node at depth i and went_left[i] the side taken from it.
+    // Indices stay valid when the array is moved by compact_reserve().
+    uint32_t path[AVL_MAX_HEIGHT + 1];
+    bool went_left[AVL_MAX_HEIGHT + 1];
+    struct cnode *nodes = ct->nodes, *ptr;
+    uint32_t idx = ct->root, tree;
+    int depth = 0, cmp = 0, bal;
+    bool shrunk;
+
+    *inserted = FALSE;
+    while (idx != CNODE_NIL)
+    {
+        cmp = KEY_CMP(data, nodes[idx].data);
+        if (cmp == 0)
+            return (&nodes[idx]); // the value is already in the tree
+        path[depth] = idx;
+        went_left[depth++] = (cmp < 0);
+        idx = (cmp < 0) ? nodes[idx].left : CNODE_RIGHT(&nodes[idx]);
+    }
+    if (ct->free_list != CNODE_NIL)
+    {
+        idx = ct->free_list;
+        ct->free_list = ct->nodes[idx].left;
+    }
+    else
+    {
+        if (!compact_reserve(ct, 1))
+            return (NULL);
+        idx = ct->used++;
+    }
+    nodes = ct->nodes;
+    ptr = &nodes[idx];
+    ptr->data = data;
+    ptr->value = zero_value;
+    ptr->left = CNODE_NIL;
+    ptr->right_bal = 1; // no right child, balance 0
+    compact_relink(ct, path, went_left, depth, idx);
+    ct->count++;
+    *inserted = TRUE;
+
+    // Walk back up as in insert(), until a node absorbs the growth or a
+    // rotation restores the old height.
+    while (depth-- > 0)
+    {
+        tree = path[depth];
+        bal = CNODE_BALANCE(&nodes[tree]) + (went_left[depth] ? 1 : -1);
+        if (bal == 0)
+        {
+            cnode_set_balance(&nodes[tree], 0);
+            break;
+        }
+        if (bal == 1 || bal == -1)
+        {
+            cnode_set_balance(&nodes[tree], bal);
+            continue;
+        }
+        tree = (bal == 2) ? compact_fix_left(nodes, tree, &shrunk) : compact_fix_right(nodes, tree, &shrunk);
+        compact_relink(ct, path, went_left, depth, tree);
+        break;
+    }
+    return (ptr);
+}
+
+// Same contract as delete()
+bool compact_delete(struct compact_tree *ct, avl_key_t data)
+{
+    uint32_t path[AVL_MAX_HEIGHT + 1];
+    bool went_left[AVL_MAX_HEIGHT + 1];
+    struct cnode *nodes = ct->nodes, *target;
+    uint32_t idx = ct->root, tree, child;
+    int depth = 0, cmp, bal;
+    bool shrunk;
+
+    // Find the node to delete
+    while (idx != CNODE_NIL && (cmp = KEY_CMP(data, nodes[idx].data)) != 0)
+    {
+        path[depth] = idx;
+        went_left[depth++] = (cmp < 0);
+        idx = (cmp < 0) ? nodes[idx].left : CNODE_RIGHT(&nodes[idx]);
+    }
+    if (idx == CNODE_NIL)
+        return (FALSE); // there is nothing to delete
+
+    target = &nodes[idx];
+    if (target->left != CNODE_NIL && CNODE_RIGHT(target) != CNODE_NIL)
+    {
+        // Continue to the in-order predecessor and unlink it instead
+        path[depth] = idx;
+        went_left[depth++] = TRUE;
+        idx = target->left;
+        while (CNODE_RIGHT(&nodes[idx]) != CNODE_NIL)
+        {
+            path[depth] = idx;
+            went_left[depth++] = FALSE;
+            idx = CNODE_RIGHT(&nodes[idx]);
+        }
+        target->data = nodes[idx].data;
+        target->value = nodes[idx].value;
+        child = nodes[idx].left;
+    }
+    else
+        child = (target->left != CNODE_NIL) ? target->left : CNODE_RIGHT(target);
+    compact_relink(ct, path, went_left, depth, child);
+    nodes[idx].left = ct->free_list;
+    ct->free_list = idx;
+    ct->count--;
+
+    // Walk back up as in delete(), while the sub-tree keeps getting lower
+    while (depth-- > 0)
+    {
+        tree = path[depth];
+        bal = CNODE_BALANCE(&nodes[tree]) - (went_left[depth] ? 1 : -1);
+        if (bal == 1 || bal == -1)
+        {
+            cnode_set_balance(&nodes[tree], bal); // the height is unchanged
+            break;
+        }
+        if (bal == 0)
+        {
+            cnode_set_balance(&nodes[tree], 0);
+            continue;
+        }
+        tree = (bal == 2) ? compact_fix_left(nodes, tree, &shrunk) : compact_fix_right(nodes, tree, &shrunk);
+        compact_relink(ct, path, went_left, depth, tree);
+        if (!shrunk)
+            break;
+    }
+    return (TRUE);
+}
+
+// Same checks as validate_node() for the compact layout
+static bool compact_validate_node(const struct compact_tree *ct, uint32_t idx, int depth, uint32_t *prev, int *height, size_t *count)
+{
+    const struct cnode *ptr;
+    int lh, rh;
+
+    if (idx == CNODE_NIL)
+    {
+        *height = 0;
+        return (TRUE);
+    }
+    if (depth > AVL_MAX_HEIGHT || idx >= ct->used)
+        return (FALSE);
+    ptr = &ct->nodes[idx];
+    if (!compact_validate_node(ct, ptr->left, depth + 1, prev, &lh, count))
+        return (FALSE);
+    if (*prev != CNODE_NIL && KEY_CMP(ct->nodes[*prev].data, ptr->data) >= 0)
+        return (FALSE);
+    *prev = idx;
+    (*count)++;
+    if (!compact_validate_node(ct, CNODE_RIGHT(ptr), depth + 1, prev, &rh, count))
+        return (FALSE);
+    if ((ptr->right_bal & 3) == 3 || CNODE_BALANCE(ptr) != lh - rh)
+        return (FALSE);
+    *height = max(lh, rh) + 1;
+    return (TRUE);
+}
+
+// Same as validate() for the compact layout
+bool compact_validate(const struct compact_tree *ct)
+{
+    uint32_t prev = CNODE_NIL;
+    size_t count = 0;
+    int height;
+
+    return (compact_validate_node(ct, ct->root, 0, &prev, &height, &count) && count == ct->count);
+}
+
+#ifdef AVL_RELAXED
+// The balance factors of a relaxed tree do not all fit into the two bits of
+// a cnode, so the copy gets the shape link_balanced() makes instead: the next
+// n nodes of the in-order walk cur go into consecutive entries of ct->nodes
+// in pre-order. Returns the index of the root and the height through *height.
+static uint32_t compact_copy(struct compact_tree *ct, struct avl_cursor *cur, size_t n, int *height)
+{
+    const struct node *ptr;
+    uint32_t idx, left, right;
+    int lh, rh;
+
+    if (n == 0)
+    {
+        *height = 0;
+        return (CNODE_NIL);
+    }
+    idx = ct->used++;
+    left = compact_copy(ct, cur, n / 2, &lh);
+    ptr = cursor_node(cur);
+    ct->nodes[idx].data = ptr->data;
+    ct->nodes[idx].value = ptr->value;
+    cursor_next(cur);
+    right = compact_copy(ct, cur, n - n / 2 - 1, &rh);
+    ct->nodes[idx].left = left;
+    ct->nodes[idx].right_bal = (right << 2) | (uint32_t)(lh - rh + 1);
+    *height = max(lh, rh) + 1;
+    return (idx);
+}
+#else
+// Copies the sub-tree below ptr into consecutive entries of ct->nodes in
+// pre-order and returns the index of its root. The room has been reserved.
+static uint32_t compact_copy(struct compact_tree *ct, const struct node *ptr)
+{
+    uint32_t idx, left;
+
+    if (ptr == NULL)
+        return (CNODE_NIL);
+    idx = ct->used++;
+    left = compact_copy(ct, ptr->left);
+    ct->nodes[idx].data = ptr->data;
+    ct->nodes[idx].value = ptr->value;
+    ct->nodes[idx].left = left;
+    ct->nodes[idx].right_bal = (compact_copy(ct, ptr->right) << 2) | (uint32_t)(ptr->balance + 1);
+    return (idx);
+}
+#endif
+
+// Replaces the contents of ct by a copy of the pointer-based tree, with the
+// same shape and balance factors (with AVL_RELAXED, in a strictly balanced
+// shape). Returns FALSE when it does not fit.
+bool compact_from_tree(struct compact_tree *ct, const struct avl_tree *avl)
+{
+#ifdef AVL_RELAXED
+    struct avl_cursor cur;
+    int height;
+#endif
+
+    compact_destroy(ct);
+    if (!compact_reserve(ct, avl->count))
+        return (FALSE);
+#ifdef AVL_RELAXED
+    cursor_first(avl->root, &cur);
+    ct->root = compact_copy(ct, &cur, avl->count, &height);
+#else
+    ct->root = compact_copy(ct, avl->root);
+#endif
+    ct->count = (uint32_t)avl->count;
+    return (TRUE);
+}
+
+// Prints how many bytes each key costs in the pointer-based and the compact
+// layout, counting every node allocated, whether in use or free. Either tree
+// may be NULL.
+void memory_report(FILE *out, const struct avl_tree *avl, const struct compact_tree *ct)
+{
+    const struct pool_chunk *chunk;
+    size_t bytes = 0;
+
+    if (avl != NULL)
+    {
+        for (chunk = avl->pool.chunks; chunk != NULL; chunk = chunk->next)
+            bytes += sizeof(struct pool_chunk) + chunk->capacity * sizeof(struct node);
+        fprintf(out, "Pointer layout : %zu bytes per node, %zu keys in %zu bytes",
+                sizeof(struct node), avl->count, bytes);
+        if (avl->count > 0)
+            fprintf(out, ", %.1f bytes per key", (double)bytes / avl->count);
+        fprintf(out, "\n");
+    }
+    if (ct != NULL)
+    {
+        bytes = (size_t)ct->capacity * sizeof(struct cnode);
+        fprintf(out, "Compact layout : %zu bytes per node, %u keys in %zu bytes",
+                sizeof(struct cnode), ct->count, bytes);
+        if (ct->count > 0)
+            fprintf(out, ", %.1f bytes per key", (double)bytes / ct->count);
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,297 @@
+// AVL tree library. The tree started out as the AVL program of the textbook
+// Data Structures Using C, 2nd edition, by Reema Thareja, Oxford University
+// Press, 2014; avl_tree_insert.c is still that console program, now built on
+// top of this library.
+//
+// The configuration macros below (AVL_STRING_KEYS, KEY_TYPE, VALUE_TYPE,
+// AVL_ORDER_STATS, AVL_INSTRUMENT, AVL_RELAXED) change the node or tree
+// layout or the balance, so the library and every program that includes this
+// header have to be compiled with the same ones.
+
+#ifndef AVL_TREE_H
+#define AVL_TREE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// The key and value types are fixed when the file is compiled, so that each
+// comparison is expanded in place instead of going through a function pointer.
+// Keys and values are int by default. Build with -DAVL_STRING_KEYS to get
+// NUL-terminated string keys compared with strcmp(); the tree only stores the
+// pointer, the string itself is owned by the caller. Other key types can be
+// used by defining KEY_TYPE together with KEY_CMP(a, b), which returns a
+// value below, equal to or above 0 like strcmp(), and KEY_FORMAT for printf().
+// VALUE_TYPE may be any type that can be assigned.
+#if defined(AVL_STRING_KEYS)
+#include <string.h>
+#define KEY_TYPE const char *
+#define KEY_CMP(a, b) strcmp((a), (b))
+#define KEY_FORMAT "%s"
+#elif !defined(KEY_TYPE)
+#define AVL_INT_KEYS
+#define KEY_TYPE int
+#define KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#define KEY_FORMAT "%d"
+#endif
+#ifndef VALUE_TYPE
+#define VALUE_TYPE int
+#endif
+
+typedef KEY_TYPE avl_key_t;
+typedef VALUE_TYPE avl_value_t;
+
+// The textbook program spelled the truth values in capitals
+#ifndef TRUE
+#define TRUE true
+#define FALSE false
+#endif
+
+// Build with -DAVL_ORDER_STATS to keep the size of every sub-tree in its root.
+// insert() and delete() then maintain it through every rotation, and
+// avl_rank(), avl_select() and avl_count_range() answer in O(log n) time.
+struct node
+{
+    avl_key_t data;
+    avl_value_t value;
+    int balance;
+#ifdef AVL_ORDER_STATS
+    size_t size; // number of nodes in the sub-tree rooted here
+#endif
+    struct node *left;
+    struct node *right;
+};
+
+// Nodes are not malloc'd one by one. They are carved out of large chunks that
+// are kept in a list, and nodes given back by delete() go onto a free list to
+// be reused by the next insert(). Chunks are only returned to the system when
+// the whole tree is destroyed.
+struct pool_chunk
+{
+    struct pool_chunk *next;
+    size_t used;     // nodes handed out from this chunk so far
+    size_t capacity; // nodes in this chunk
+    struct node nodes[];
+};
+
+struct node_pool
+{
+    struct pool_chunk *chunks; // newest chunk first, only that one has unused nodes
+    struct node *free_list;    // reclaimed nodes, chained through their right pointer
+};
+
+// Balancing policy, fixed at compile time like the key type. By default the
+// tree is a strict AVL tree: the two sub-trees of every node differ in height
+// by at most one level. Build with -DAVL_RELAXED to allow two levels. An
+// update then only rotates once a node is three levels out of balance, so
+// write-heavy loads rotate less, and avl_rebalance() restores the strict
+// bound when the writers are idle. In between the tree can be higher and
+// lookups go a little deeper. The balance factor stays the height
+// difference either way, so everything that works on heights, such as split,
+// join and the set operations, is the same for both.
+#ifdef AVL_RELAXED
+#define AVL_MAX_BALANCE (2)
+#else
+#define AVL_MAX_BALANCE (1)
+#endif
+
+// An AVL tree with n nodes is at most about 1.44*log2(n) levels high, and a
+// relaxed one 1.81*log2(n), so a path of this many links covers every tree
+// that fits in memory.
+#define AVL_MAX_HEIGHT (64)
+
+// Lookups that search_batch() keeps going side by side
+#define SEARCH_BATCH (16)
+
+// Counters kept per tree by insert() and delete(). The rotation names follow
+// the slides: LL/LR/RR/RL on insertion, R0/R1/R-1 when a deletion shrinks the
+// right sub-tree and L0/L1/L-1 when it shrinks the left one.
+struct avl_stats
+{
+    size_t rot_ll, rot_lr, rot_rr, rot_rl;
+    size_t rot_r0, rot_r1, rot_rm1;
+    size_t rot_l0, rot_l1, rot_lm1;
+    size_t allocations; // nodes taken from the pool by insert()
+    size_t comparisons; // nodes whose data was compared during a descent
+    int max_depth;      // longest root-to-node descent seen
+};
+
+// Build with -DAVL_INSTRUMENT to time every insert(), delete() and
+// avl_search() of a tree. The latencies go into histograms with 16 buckets
+// per power of two, which keep every value to within 1/16 without storing
+// it, so the tails (p99, p999) are as exact as the median. Next to them the
+// depth of every descent and the rotations of every update are counted.
+// Without AVL_INSTRUMENT none of this is compiled in and the operations are
+// the same code as before.
+#ifdef AVL_INSTRUMENT
+#define HIST_SUB_BITS (4)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+enum avl_op
+{
+    AVL_OP_INSERT,
+    AVL_OP_DELETE,
+    AVL_OP_SEARCH,
+    AVL_NOPS
+};
+
+struct avl_histogram
+{
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+struct avl_instrument
+{
+    struct avl_histogram latency[AVL_NOPS]; // in clock ticks, see avl_instrument_dump()
+    struct avl_histogram pool_grow;         // the inserts that took a new chunk from malloc()
+    uint64_t depth[AVL_NOPS][AVL_MAX_HEIGHT + 1];
+    uint64_t rotations[AVL_OP_SEARCH][AVL_MAX_HEIGHT + 1]; // per insert and per delete
+};
+#endif
+
+struct avl_tree
+{
+    struct node *root;
+    size_t count; // nodes in the tree
+    struct node_pool pool;
+    struct avl_stats stats;
+#ifdef AVL_INSTRUMENT
+    struct avl_instrument instrument;
+#endif
+};
+
+// Cursors. A cursor keeps the path from the root down to its node, so it can
+// step to the next or previous key without parent pointers in the nodes and
+// without recursion. Stepping is amortized O(1). A cursor is only valid while
+// the tree is not changed by insert() or delete().
+struct avl_cursor
+{
+    const struct node *path[AVL_MAX_HEIGHT + 1]; // path[depth - 1] is the current node
+    int depth;                                   // 0 once the cursor has moved past either end
+};
+
+// Compact layout. The nodes of a compact_tree live in one array and refer to
+// their children by 32-bit index instead of by pointer. Index 0 stands for the
+// empty sub-tree, so nodes[0] is never used. The balance factor only takes the
+// values -1, 0 and 1, so it is kept as balance + 1 in the two low bits of the
+// right child index. With int keys and values a node takes 16 bytes instead of
+// 32, and four of them fit in a 64-byte cache line.
+#define CNODE_NIL (0)
+#define CNODE_MAX ((1u << 30) - 1) // largest index that fits next to the balance
+
+struct cnode
+{
+    avl_key_t data;
+    avl_value_t value;
+    uint32_t left;
+    uint32_t right_bal; // right child index << 2 | (balance + 1)
+};
+
+#define CNODE_RIGHT(n) ((n)->right_bal >> 2)
+#define CNODE_BALANCE(n) ((int)((n)->right_bal & 3) - 1)
+
+struct compact_tree
+{
+    struct cnode *nodes;
+    uint32_t root;
+    uint32_t count;     // nodes in the tree
+    uint32_t used;      // entries of nodes[] handed out so far, nodes[0] included
+    uint32_t capacity;  // entries allocated in nodes[]
+    uint32_t free_list; // released nodes, chained through their left index
+};
+
+// Node pool
+void pool_init(struct node_pool *pool);
+struct node *pool_alloc(struct node_pool *pool);
+struct node *pool_alloc_block(struct node_pool *pool, size_t n);
+void pool_merge(struct node_pool *pool, struct node_pool *from);
+void pool_free(struct node_pool *pool, struct node *ptr);
+void pool_destroy(struct node_pool *pool);
+
+// Tree handle and statistics
+void avl_init(struct avl_tree *avl);
+void avl_destroy(struct avl_tree *avl);
+void avl_stats_reset(struct avl_tree *avl);
+void avl_stats_dump(const struct avl_tree *avl, FILE *out);
+#ifdef AVL_INSTRUMENT
+void avl_instrument_reset(struct avl_tree *avl);
+// Latencies in ns with p50, p99, p999 and max per operation, then the depth
+// and rotation counts. With json TRUE it is one JSON object for tools.
+void avl_instrument_dump(const struct avl_tree *avl, FILE *out, bool json);
+#endif
+
+// Lookup and update
+struct node *search(struct node *ptr, avl_key_t data);
+struct node *avl_search(struct avl_tree *avl, avl_key_t data); // search() that is instrumented
+size_t search_batch(struct node *root, const avl_key_t *keys, size_t n, struct node **out);
+struct node *insert(struct avl_tree *avl, avl_key_t data, bool *inserted);
+bool delete(struct avl_tree *avl, avl_key_t data);
+struct node *findLargestElement(struct node *tree);
+bool validate(const struct avl_tree *avl);
+void avl_rebalance(struct avl_tree *avl);
+
+// Rebalancing after an update, shared with the copy-on-write trees of avl_rcu.c
+void insert_rebalance(struct node **path[], int depth, struct avl_stats *stats);
+void delete_rebalance(struct node **path[], int depth, struct avl_stats *stats,
+                      struct node *(*unshare)(void *ctx, struct node *ptr), void *ctx);
+
+// Printing
+void display(struct node *ptr, int level);
+void inorder(struct node *ptr);
+
+// Cursors and range scans
+const struct node *cursor_node(const struct avl_cursor *cur);
+const struct node *cursor_first(const struct node *root, struct avl_cursor *cur);
+const struct node *cursor_last(const struct node *root, struct avl_cursor *cur);
+const struct node *cursor_lower_bound(const struct node *root, avl_key_t data, struct avl_cursor *cur);
+const struct node *cursor_upper_bound(const struct node *root, avl_key_t data, struct avl_cursor *cur);
+const struct node *cursor_next(struct avl_cursor *cur);
+const struct node *cursor_prev(struct avl_cursor *cur);
+size_t range_scan(const struct node *root, avl_key_t lo, avl_key_t hi,
+                  bool (*visit)(void *ctx, const struct node *ptr), void *ctx);
+size_t range_copy(const struct node *root, avl_key_t lo, avl_key_t hi, avl_key_t *out, size_t max);
+
+#ifdef AVL_ORDER_STATS
+// Order statistics
+size_t avl_rank(const struct avl_tree *avl, avl_key_t data);
+struct node *avl_select(const struct avl_tree *avl, size_t k);
+size_t avl_count_range(const struct avl_tree *avl, avl_key_t lo, avl_key_t hi);
+#endif
+
+// Bulk loading
+int avl_build_stream(struct avl_tree *avl, size_t n,
+                     bool (*next)(void *ctx, avl_key_t *data, avl_value_t *value), void *ctx);
+int avl_build_sorted(struct avl_tree *avl, const avl_key_t *keys, const avl_value_t *values, size_t n);
+int avl_build(struct avl_tree *avl, const avl_key_t *keys, const avl_value_t *values, size_t n);
+
+// Split and join with the heights of the trees passed along, shared with the
+// set operations of avl_set.c. The height of a sub-tree follows from the
+// height of its parent and the parent's balance factor.
+#define LEFT_HEIGHT(ptr, h) ((h) - 1 + ((ptr)->balance < 0 ? (ptr)->balance : 0))
+#define RIGHT_HEIGHT(ptr, h) ((h) - 1 - ((ptr)->balance > 0 ? (ptr)->balance : 0))
+int tree_height(const struct node *ptr);
+struct node *tree_join(struct node *left, int lh, struct node *mid, struct node *right, int rh,
+                       int *height, struct avl_stats *stats);
+struct node *tree_split(struct node *ptr, int h, avl_key_t data, struct node **left, int *lh,
+                        struct node **right, int *rh, struct avl_stats *stats);
+struct node *tree_join2(struct node *left, int lh, struct node *right, int rh, int *height, struct avl_stats *stats);
+
+// Batches, by split and join
+long insert_batch(struct avl_tree *avl, const avl_key_t *keys, const avl_value_t *values, size_t n);
+long delete_batch(struct avl_tree *avl, const avl_key_t *keys, size_t n);
+
+// Compact layout
+void compact_init(struct compact_tree *ct);
+void compact_destroy(struct compact_tree *ct);
+bool compact_reserve(struct compact_tree *ct, size_t n);
+struct cnode *compact_search(const struct compact_tree *ct, avl_key_t data);
+struct cnode *compact_insert(struct compact_tree *ct, avl_key_t data, bool *inserted);
+bool compact_delete(struct compact_tree *ct, avl_key_t data);
+bool compact_validate(const struct compact_tree *ct);
+bool compact_from_tree(struct compact_tree *ct, const struct avl_tree *avl);
+void memory_report(FILE *out, const struct avl_tree *avl, const struct compact_tree *ct);
+
+#endif
@@ -0,0 +1,270 @@
+// B-tree of int keys, the cache-friendly baseline of avl_bench.c.
+// It follows the CLRS formulation with minimum degree BTREE_T: every node but
+// the root holds between BTREE_T - 1 and 2 * BTREE_T - 1 keys, full nodes are
+// split on the way down during insertion, and during deletion every child is
+// given at least BTREE_T keys before the descent enters it, so neither needs
+// to walk back up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BTREE_T (16)
+#define BTREE_MAX_KEYS (2 * BTREE_T - 1)
+
+struct btree_node
+{
+    int n;    // keys in use
+    int leaf; // 1 when the node has no children
+    int keys[BTREE_MAX_KEYS];
+    struct btree_node *child[BTREE_MAX_KEYS + 1];
+};
+
+struct btree
+{
+    struct btree_node *root;
+};
+
+struct btree_node *btree_new_node(int leaf)
+{
+    struct btree_node *x = (struct btree_node *)malloc(sizeof(struct btree_node));
+    if (x == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    x->n = 0;
+    x->leaf = leaf;
+    return x;
+}
+
+void btree_init(struct btree *bt)
+{
+    bt->root = NULL;
+}
+
+void btree_free_node(struct btree_node *x)
+{
+    int i;
+    if (!x->leaf)
+        for (i = 0; i <= x->n; i++)
+            btree_free_node(x->child[i]);
+    free(x);
+}
+
+void btree_destroy(struct btree *bt)
+{
+    if (bt->root != NULL)
+        btree_free_node(bt->root);
+    bt->root = NULL;
+}
+
+// Index of the first key in x that is not smaller than key
+int btree_find(const struct btree_node *x, int key)
+{
+    int i = 0;
+    while (i < x->n && x->keys[i] < key)
+        i++;
+    return i;
+}
+
+int btree_search(const struct btree *bt, int key)
+{
+    const struct btree_node *x = bt->root;
+    int i;
+
+    while (x != NULL)
+    {
+        i = btree_find(x, key);
+        if (i < x->n && x->keys[i] == key)
+            return 1;
+        x = x->leaf ? NULL : x->child[i];
+    }
+    return 0;
+}
+
+// Splits the full child x->child[i] around its median, which moves up into x
+void btree_split_child(struct btree_node *x, int i)
+{
+    struct btree_node *y = x->child[i];
+    struct btree_node *z = btree_new_node(y->leaf);
+
+    z->n = BTREE_T - 1;
+    memcpy(z->keys, &y->keys[BTREE_T], (BTREE_T - 1) * sizeof(int));
+    if (!y->leaf)
+        memcpy(z->child, &y->child[BTREE_T], BTREE_T * sizeof(struct btree_node *));
+    y->n = BTREE_T - 1;
+    memmove(&x->child[i + 2], &x->child[i + 1], (x->n - i) * sizeof(struct btree_node *));
+    x->child[i + 1] = z;
+    memmove(&x->keys[i + 1], &x->keys[i], (x->n - i) * sizeof(int));
+    x->keys[i] = y->keys[BTREE_T - 1];
+    x->n++;
+}
+
+// Returns 1 when key was inserted and 0 when it was already in the tree
+int btree_insert(struct btree *bt, int key)
+{
+    struct btree_node *x, *s;
+    int i;
+
+    if (bt->root == NULL)
+        bt->root = btree_new_node(1);
+    if (bt->root->n == BTREE_MAX_KEYS) // the tree grows at the root
+    {
+        s = btree_new_node(0);
+        s->child[0] = bt->root;
+        btree_split_child(s, 0);
+        bt->root = s;
+    }
+    x = bt->root;
+    for (;;)
+    {
+        i = btree_find(x, key);
+        if (i < x->n && x->keys[i] == key)
+            return 0;
+        if (x->leaf)
+            break;
+        if (x->child[i]->n == BTREE_MAX_KEYS)
+        {
+            btree_split_child(x, i);
+            if (key == x->keys[i])
+                return 0;
+            if (key > x->keys[i])
+                i++;
+        }
+        x = x->child[i];
+    }
+    memmove(&x->keys[i + 1], &x->keys[i], (x->n - i) * sizeof(int));
+    x->keys[i] = key;
+    x->n++;
+    return 1;
+}
+
+// Moves x->keys[i] and all of x->child[i + 1] into x->child[i]
+void btree_merge(struct btree_node *x, int i)
+{
+    struct btree_node *y = x->child[i], *z = x->child[i + 1];
+
+    y->keys[y->n] = x->keys[i];
+    memcpy(&y->keys[y->n + 1], z->keys, z->n * sizeof(int));
+    if (!y->leaf)
+        memcpy(&y->child[y->n + 1], z->child, (z->n + 1) * sizeof(struct btree_node *));
+    y->n += z->n + 1;
+    memmove(&x->keys[i], &x->keys[i + 1], (x->n - i - 1) * sizeof(int));
+    memmove(&x->child[i + 1], &x->child[i + 2], (x->n - i - 1) * sizeof(struct btree_node *));
+    x->n--;
+    free(z);
+}
+
+// Makes sure x->child[i] has at least BTREE_T keys by borrowing from a sibling
+// or merging with one. Returns the index of the child to descend into.
+int btree_fill(struct btree_node *x, int i)
+{
+    struct btree_node *c = x->child[i], *s;
+
+    if (i > 0 && x->child[i - 1]->n >= BTREE_T) // borrow from the left sibling
+    {
+        s = x->child[i - 1];
+        memmove(&c->keys[1], c->keys, c->n * sizeof(int));
+        if (!c->leaf)
+            memmove(&c->child[1], c->child, (c->n + 1) * sizeof(struct btree_node *));
+        c->keys[0] = x->keys[i - 1];
+        if (!c->leaf)
+            c->child[0] = s->child[s->n];
+        x->keys[i - 1] = s->keys[s->n - 1];
+        s->n--;
+        c->n++;
+        return i;
+    }
+    if (i < x->n && x->child[i + 1]->n >= BTREE_T) // borrow from the right sibling
+    {
+        s = x->child[i + 1];
+        c->keys[c->n] = x->keys[i];
+        if (!c->leaf)
+            c->child[c->n + 1] = s->child[0];
+        x->keys[i] = s->keys[0];
+        memmove(s->keys, &s->keys[1], (s->n - 1) * sizeof(int));
+        if (!s->leaf)
+            memmove(s->child, &s->child[1], s->n * sizeof(struct btree_node *));
+        s->n--;
+        c->n++;
+        return i;
+    }
+    if (i < x->n)
+    {
+        btree_merge(x, i);
+        return i;
+    }
+    btree_merge(x, i - 1);
+    return i - 1;
+}
+
+int btree_delete_from(struct btree_node *x, int key)
+{
+    struct btree_node *y;
+    int i;
+
+    for (;;)
+    {
+        i = btree_find(x, key);
+        if (i < x->n && x->keys[i] == key)
+        {
+            if (x->leaf)
+            {
+                memmove(&x->keys[i], &x->keys[i + 1], (x->n - i - 1) * sizeof(int));
+                x->n--;
+                return 1;
+            }
+            if (x->child[i]->n >= BTREE_T) // replace by the predecessor
+            {
+                for (y = x->child[i]; !y->leaf; y = y->child[y->n])
+                    ;
+                key = x->keys[i] = y->keys[y->n - 1];
+                x = x->child[i];
+                continue;
+            }
+            if (x->child[i + 1]->n >= BTREE_T) // replace by the successor
+            {
+                for (y = x->child[i + 1]; !y->leaf; y = y->child[0])
+                    ;
+                key = x->keys[i] = y->keys[0];
+                x = x->child[i + 1];
+                continue;
+            }
+            btree_merge(x, i);
+            x = x->child[i];
+            continue;
+        }
+        if (x->leaf)
+            return 0;
+        if (x->child[i]->n < BTREE_T)
+            i = btree_fill(x, i);
+        x = x->child[i];
+    }
+}
+
+// Returns 1 when key was found and removed
+int btree_delete(struct btree *bt, int key)
+{
+    struct btree_node *r = bt->root;
+    int found;
+
+    if (r == NULL)
+        return 0;
+    found = btree_delete_from(r, key);
+    if (r->n == 0) // the tree shrinks at the root
+    {
+        bt->root = r->leaf ? NULL : r->child[0];
+        free(r);
+    }
+    return found;
+}
+
+int btree_height(const struct btree *bt)
+{
+    const struct btree_node *x;
+    int h = 0;
+    for (x = bt->root; x != NULL; x = x->leaf ? NULL : x->child[0])
+        h++;
+    return h;
+}